@@ -2,22 +2,28 @@
 
 using namespace std;
 
+// names of the operations picked by planGlitch, by op id
+static const vector<string> AVI_OPERATION_NAMES = { "substitute", "gray", "negate", "shift", "lag", "noise", "copy" };
+
 // 查找可能的视频帧起始位置
 std::vector<size_t> AVICorruptor::findPotentialFrameStarts() {
     std::vector<size_t> frame_starts;
-    for (size_t i = AVI_HEADER_PROTECT_SIZE; i < file_data.size() - AVI_TAIL_PROTECT_SIZE; ++i) {
-        // check frame markers: 00dc, 01wb, db, etc.
-        if ((file_data[i] == '0' || file_data[i] == '1') && (file_data[i + 1] == '0' || file_data[i + 1] == '1')) {
-			char c = file_data[i + 2];
-			char d = file_data[i + 3];
-            if ((c == 'd' || c == 'w') && (d == 'c' || d == 'b')) {
-				frame_starts.push_back(i);
-            }
+    if (has_riff_index) {
+        // exact chunk offsets from the index
+        frame_starts.reserve(riff_parser.getChunks().size());
+        for (const auto& chunk : riff_parser.getChunks()) {
+            frame_starts.push_back(chunk.offset);
+        }
+        return frame_starts;
+    }
+    size_t end = file_data.size() > AVI_TAIL_PROTECT_SIZE ? file_data.size() - AVI_TAIL_PROTECT_SIZE : 0;
+    // check frame markers: 00dc, 01wb, db, etc.
+    for (const auto& hit : scan_hits) {
+        if (hit.type == AVI_SIG_FRAME && hit.offset >= AVI_HEADER_PROTECT_SIZE && hit.offset < end) {
+            frame_starts.push_back(hit.offset);
         }
     }
-    // 去重排序并过滤
-    std::sort(frame_starts.begin(), frame_starts.end());
-    frame_starts.erase(std::unique(frame_starts.begin(), frame_starts.end()), frame_starts.end());
+    // scanner hits are already sorted and unique
     
     //no need to filter
     
@@ -26,47 +32,59 @@ std::vector<size_t> AVICorruptor::findPotentialFrameStarts() {
 
 // 预计算保护区域
 void AVICorruptor::precomputeProtectedMask() {
-    protected_mask.assign(file_data.size(), false);
+    protected_ranges.clear();
+    if (!early_scan) scan_hits.clear();
+
+    // walk the RIFF tree first, the signature scan is only a fallback for damaged files
+    auto parse_start = chrono::steady_clock::now();
+    has_riff_index = riff_parser.parse(file_data.data(), file_data.size()) && !riff_parser.getChunks().empty();
+    metrics.addScan("riff", file_data.size(), riff_parser.getChunks().size(), CorruptionMetrics::since(parse_start));
+    if (has_riff_index) {
+        protectFromRiffIndex();
+        return;
+    }
+    log() << "No usable RIFF index, falling back to signature scan" << endl;
+
+    // one pass for all signatures, in chunks across the threads
+    if (!early_scan) {
+        auto scan_start = chrono::steady_clock::now();
+        scan_hits = scanFile(scanner);
+        metrics.addScan("signature", file_data.size(), scan_hits.size(), CorruptionMetrics::since(scan_start));
+    }
 
     // protect avi header
     size_t header_size = min((size_t)AVI_HEADER_PROTECT_SIZE, file_data.size());
-    std::fill(protected_mask.begin(), protected_mask.begin() + header_size, true);
+    protected_ranges.add(0, header_size);
 
-	const char* signatures[] = { "RIFF", "LIST","idx1", "hdrl", "avih", "strl", "strh", "strf","strd","movi","JUNK"};
 	// detect LIST chunks
     vector<size_t> list_begins;
-    size_t idx_pos;
+    size_t idx_pos = SIZE_MAX;
 	// protect idx1 list and other important headers
-    for (size_t i = header_size; i < file_data.size() - 4; ++i) {
-        
-        for(const char* sig : signatures){
-            if (file_data[i] == sig[0] && file_data[i + 1] == sig[1] &&
-                file_data[i + 2] == sig[2] && file_data[i + 3] == sig[3]) {
-				protected_mask[i] = true;
-                protected_mask[i+1] = true;
-                protected_mask[i + 2] = true;
-                protected_mask[i + 3] = true;
-                // check for RIFF and LIST signatures
-                if (strcmp(sig, "LIST") == 0) {
-                    list_begins.push_back(i);
-				}
-                if(strcmp(sig, "idx1") == 0){
-                    idx_pos = i;
-				}
-                break;
-            }
-		}
+    for (const auto& hit : scan_hits) {
+        if (hit.type == AVI_SIG_FRAME || hit.offset < header_size || hit.offset + 4 >= file_data.size()) continue;
+        size_t i = hit.offset;
+        protected_ranges.add(i, i + 4);
+        // check for RIFF and LIST signatures
+        if (hit.type == AVI_SIG_LIST) {
+            list_begins.push_back(i);
+        }
+        if (hit.type == AVI_SIG_IDX1) {
+            idx_pos = i;
+        }
     }
 
-    // protect idx1 index
-    if (upper_bound(list_begins.begin(), list_begins.end(), idx_pos) == list_begins.end()) {
-		fill(protected_mask.begin() + min(idx_pos, file_data.size()), protected_mask.end(), true);
-        cout << "idx1 list detected from byte #" << min(idx_pos, file_data.size()) << " to #" << file_data.size() - 1 <<" - protected" << endl;
+    // protect idx1 index, a file cut before its index has none
+    if (idx_pos == SIZE_MAX) {
+        log() << "No idx1 list found" << endl;
+    }
+    else if (upper_bound(list_begins.begin(), list_begins.end(), idx_pos) == list_begins.end()) {
+		protected_ranges.add(min(idx_pos, file_data.size()), file_data.size());
+        log() << "idx1 list detected from byte #" << min(idx_pos, file_data.size()) << " to #" << file_data.size() - 1 <<" - protected" << endl;
     }
     else {
         size_t next_list_pos = *upper_bound(list_begins.begin(), list_begins.end(), idx_pos);
-        fill(protected_mask.begin() + min(idx_pos, file_data.size()), protected_mask.begin() + min(next_list_pos, file_data.size()), true);
-        cout << "idx1 list detected from " << min(idx_pos, file_data.size()) << " to " << min(next_list_pos, file_data.size())-1 << " - protected" << endl;
+        protected_ranges.add(min(idx_pos, file_data.size()), min(next_list_pos, file_data.size()));
+        log() << "idx1 list detected from " << min(idx_pos, file_data.size()) << " to " << min(next_list_pos, file_data.size())-1 << " - protected" << endl;
     }
 
     // get frame headers
@@ -76,188 +94,237 @@ void AVICorruptor::precomputeProtectedMask() {
     // 保护已检测到的帧头
     for (auto pos : frame_starts) {
         size_t frame_end = std::min(pos + AVI_FRAME_HEADER_SIZE, file_data.size());
-        std::fill(protected_mask.begin() + pos, protected_mask.begin() + frame_end, true);
+        protected_ranges.add(pos, frame_end);
     }
+    protected_ranges.normalize();
 }
 
-bool AVICorruptor::loadFile(const std::string& filename) {
+void AVICorruptor::protectFromRiffIndex() {
+    // only chunk payloads past the frame header may be touched; RIFF/LIST headers,
+    // hdrl, idx1, indx/ix## and padding all fall into the gaps
+    const auto& chunks = riff_parser.getChunks();
+    size_t pos = 0;
+    for (const auto& chunk : chunks) {
+        size_t payload_begin = min((size_t)(chunk.offset + AVI_FRAME_HEADER_SIZE), file_data.size());
+        size_t payload_end = min((size_t)(chunk.offset + 8 + chunk.size), file_data.size());
+        if (payload_begin >= payload_end) continue;
+        if (payload_begin > pos) protected_ranges.add(pos, payload_begin);
+        pos = max(pos, payload_end);
+    }
+    if (pos < file_data.size()) protected_ranges.add(pos, file_data.size());
+    protected_ranges.normalize();
+    frmcount = chunks.size();
+
+    log() << "RIFF index: " << chunks.size() << " stream chunks from "
+        << AVIRiffParser::indexSourceName(riff_parser.getIndexSource()) << ", "
+        << riff_parser.getSegmentCount() << " RIFF segment(s), "
+        << riff_parser.getMoviLists().size() << " movi list(s)" << endl;
+}
+
+void AVICorruptor::glitchWindow(size_t& begin, size_t& end) const {
+    if (has_riff_index && !riff_parser.getMoviLists().empty()) {
+        begin = (size_t)riff_parser.getMoviLists().front().begin;
+        end = (size_t)riff_parser.getMoviLists().back().end;
+        return;
+    }
+    size_t safe_margin = AVI_HEADER_PROTECT_SIZE + AVI_TAIL_PROTECT_SIZE;
+    begin = AVI_HEADER_PROTECT_SIZE;
+    end = file_data.size() > safe_margin ? file_data.size() - AVI_TAIL_PROTECT_SIZE : begin;
+}
+
+bool AVICorruptor::readFile(const std::string& filename) {
 	string file_ext = filename.substr(filename.find_last_of('.') + 1);
     if(file_ext != "avi" && file_ext != "AVI"){
         std::cerr << "Error: Not an AVI file: " << filename << std::endl;
         return false;
 	}
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file) {
-        std::cerr << "Error opening file: " << filename << std::endl;
-        return false;
-    }
+    return readFileData(filename);
+}
 
-    file_data.resize(file.tellg());
-    file.seekg(0, std::ios::beg);
-    file.read(reinterpret_cast<char*>(file_data.data()), file_data.size());
-    file.close();
+bool AVICorruptor::analyze() {
+    auto start_time = chrono::steady_clock::now();
+    metrics.format = "avi";
+    // without RIFF AVI in front the RIFF walk finds nothing and the signature scan decides; it
+    // then runs on the chunks already read while the rest is loading (the sidecar hashes the
+    // whole file, so a cached run waits for it)
+    size_t head = file_data.waitLoaded(min<size_t>(12, file_data.size()));
+    early_scan = file_data.loading() && !use_analysis_cache &&
+        !(head >= 12 && memcmp(file_data.data(), "RIFF", 4) == 0 && memcmp(file_data.data() + 8, "AVI ", 4) == 0);
+    if (early_scan) {
+        auto scan_start = chrono::steady_clock::now();
+        scan_hits = scanLoading(scanner);
+        metrics.addScan("signature", file_data.size(), scan_hits.size(), CorruptionMetrics::since(scan_start));
+    }
+    if (!finishRead()) return false;
+    AnalysisIndex index;
+    // waiting for the rest of the file counts as read, not as analysis
+    if (!early_scan) start_time = chrono::steady_clock::now();
+    if (loadAnalysis(index, ANALYSIS_FORMAT_AVI) && index.regions.size() == 1) {
+        has_riff_index = (index.flags & 1) != 0;
+        frame_starts.assign(index.frame_starts.begin(), index.frame_starts.end());
+        window_begin = (size_t)index.regions[0].offset;
+        window_end = (size_t)(index.regions[0].offset + index.regions[0].size);
+    }
+    else {
+        precomputeProtectedMask();
+        frame_starts = findPotentialFrameStarts();
+        glitchWindow(window_begin, window_end);
 
-    precomputeProtectedMask();
-    std::cout << "Loaded AVI file (" << file_data.size() << " bytes)" << std::endl;
+        index.format = ANALYSIS_FORMAT_AVI;
+        index.flags = has_riff_index ? 1 : 0;
+        index.frame_count = frmcount;
+        index.protected_ranges.assign(protected_ranges.begin(), protected_ranges.end());
+        index.frame_starts.assign(frame_starts.begin(), frame_starts.end());
+        index.regions.push_back({ window_begin, window_end - window_begin, 0 });
+        saveAnalysis(index);
+    }
+    metrics.protected_bytes = protected_ranges.coveredBytes();
+    metrics.frames = frame_starts.size();
+    metrics.addPhase("analyze", CorruptionMetrics::since(start_time));
+    log() << "Loaded AVI file (" << file_data.size() << " bytes"
+        << (file_data.isMapped() ? ", memory-mapped" : "") << ")" << std::endl;
     return true;
 }
 
 bool AVICorruptor::saveFile(const std::string& filename) {
-    std::ofstream out(filename, std::ios::binary);
-    if (!out) {
-        std::cerr << "Error creating output file: " << filename << std::endl;
-        return false;
-    }
-    out.write(reinterpret_cast<char*>(file_data.data()), file_data.size());
-    out.close();
-    return true;
+    auto start_time = chrono::steady_clock::now();
+    bool ok = file_data.save(filename);
+    metrics.addPhase("save", CorruptionMetrics::since(start_time));
+    metrics.save_method = file_data.saveMethod();
+    metrics.saved_bytes = file_data.savedBytes();
+    return ok;
 }
 
 void AVICorruptor::applyCorruption() {
-    std::cout << "Starting corruption process..." << std::endl;
+    log() << "Starting corruption process..." << std::endl;
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    auto frame_starts = findPotentialFrameStarts();
-    std::cout << "Found " << frame_starts.size() << " potential frame starts" << std::endl;
-    size_t glitch_range = file_data.size() - AVI_HEADER_PROTECT_SIZE - AVI_TAIL_PROTECT_SIZE;
-    std::cout << "Safe zone has " << glitch_range << " bytes." << std::endl;
+    log() << "Found " << frame_starts.size() << " potential frame starts" << std::endl;
+    size_t glitch_range = window_end - window_begin;
+    log() << "Safe zone has " << glitch_range << " bytes." << std::endl;
+    log() << "Seed: " << seed << std::endl;
+    metrics.beginCorruption(stages.size(), AVI_OPERATION_NAMES);
+    auto plan_start = chrono::steady_clock::now();
+    vector<vector<size_t>> stage_positions(stages.size());
     for (size_t stage_idx = 0; stage_idx < stages.size(); ++stage_idx) {
         const auto& stage = stages[stage_idx];
 		
-        size_t start = static_cast<size_t>(AVI_HEADER_PROTECT_SIZE + stage.start_ratio * glitch_range);
-        size_t end = static_cast<size_t>(AVI_HEADER_PROTECT_SIZE + stage.end_ratio * glitch_range);
-        size_t target_glitches = static_cast<size_t>(stage.intensity * frmcount);
+        size_t start = static_cast<size_t>(window_begin + stage.start_ratio * glitch_range);
+        size_t end = static_cast<size_t>(window_begin + stage.end_ratio * glitch_range);
+        size_t target_glitches = stageGlitches(stage);
         
-        std::cout << "Stage " << (stage_idx + 1) << ": "
+        log() << "Stage " << (stage_idx + 1) << ": "
             << (stage.start_ratio * 100) << "% - "
             << (stage.end_ratio * 100) << "% intensity "
             << (stage.intensity * 100) << "%, target " << target_glitches
             << " glitches" << std::endl;
 
-        std::vector<size_t> corruption_positions;
-        corruption_positions.reserve(target_glitches);
-        std::uniform_int_distribution<> pos_dist(start, end - 1);
-        
-        // 生成破坏位置
-        for (size_t i = 0; i < target_glitches; ++i) {
-            size_t pos;
-            do {
-                pos = pos_dist(rng);
-            } while (protected_mask[pos]);
-            corruption_positions.push_back(pos);
+        // 生成破坏位置: drawn directly from the unprotected bytes of the stage window, in address order
+        PositionSampler sampler(protected_ranges);
+        sampler.addWindow(start, end);
+        std::vector<size_t>& corruption_positions = stage_positions[stage_idx];
+        corruption_positions = sampler.drawSorted(rng, target_glitches);
+        metrics.stages[stage_idx].requested = target_glitches;
+        metrics.stages[stage_idx].drawn = corruption_positions.size();
+        if (corruption_positions.size() < target_glitches) {
+            log() << "Stage window is fully protected, no glitches applied" << std::endl;
         }
+    }
 
-        // 批量破坏
-        stage_idx = stage_idx > 6 ? 6 : stage_idx;
-        std::uniform_int_distribution<int> dist(min(0,(int)stage_idx-2), stage_idx);
-        
+    // all stages as one forward sweep; a burst stops at the next protected byte
+    vector<Glitch> plan;
+    addGlitchSweep(plan, stage_positions);
+
+    metrics.addPhase("plan", CorruptionMetrics::since(plan_start));
 
-        size_t processed = 0;
-        //glitch size (bytes)
-		int burst_size = stage.burst_size;
-        size_t report_interval = min((size_t)AVI_PROGRESS_REPORT_INTERVAL, target_glitches);
-        std::uniform_int_distribution<int> byte_dist(0, 255);
-        std::uniform_int_distribution<int> flip_dist(0, 7);
-        std::uniform_int_distribution<int> dir_dist(0, 1);
-        while (processed < target_glitches) {
-            size_t chunk = min(report_interval, target_glitches - processed);
-            std::vector<size_t> chunk_list(corruption_positions.begin() + processed,
-                corruption_positions.begin() + processed + chunk);
-            
-            for (auto pos : chunk_list) {
-                int rand_val = dist(rng);
-                // 随机破坏方式
-                //int rand_val = 4;
-                int bit_pos;
-                switch (rand_val) {
-                case 0:
-                    for (int j = 0; j < burst_size; j++) {
-                        //bits random substitution
-                        if (!protected_mask[pos + j]) {
-                            file_data[pos + j] = (file_data[pos + j] & 0xF0) | (static_cast<uint8_t>(byte_dist(rng)) & 0x0F);
-                        }
-                    }
-                    break;
-                case 1:
-                    for (int j = 0; j < burst_size; j++) {
-                        // set to 0x80 (gray)
-                        if (!protected_mask[pos + j]) file_data[pos + j] = 0x80;
-                    }
-                    break;
-                case 2:
-                    for (int j = 0; j < burst_size; j++) {
-                        // invert color 
-                        if (!protected_mask[pos + j]) file_data[pos + j] = ~file_data[pos + j] + 1;
-                    }
-                    break;
-                case 3:
-                    for (int j = 0; j < burst_size; j++) {
-                        // shift
-                        if (!protected_mask[pos + j]) {
-                            if (dir_dist(rng)) {
-                                file_data[pos + j] <<= 1+int(stage.intensity*6);
-                            }
-                            else {
-                                file_data[pos + j] >>= 1 + int(stage.intensity * 6);
-                            }
-                        }
-                    }
-                    break;
-                case 4:
-                    // lag simulation
-                    for (int j = 0; j < burst_size; j++) {
-                        if (!protected_mask[pos + j])file_data[pos + j] = file_data[pos];
-                    }
-                    break;
-                
-                case 5:
-					// voltage spike / random noise
-                    for (int j = 0; j < burst_size; j++) {
-                        
-                        if (!protected_mask[pos + j]) {
-                            
-                            ((pos+j)&1)==0 ? file_data[pos + j] ^= byte_dist(rng): file_data[pos + j] = byte_dist(rng);
-                            
-                        }
-                    }
-                    break;
-                case 6:
-                    // copying from previous location
-                    size_t copy_offset;
+    // all stages at once, spread over the thread pool
+    log() << "Applying " << plan.size() << " glitches..." << std::endl;
+    runGlitches(plan);
 
-                    for (int j = 0; j < burst_size; j++) {
-                        copy_offset = 5000 + pos_dist(rng) % 50000;
-                        if (!protected_mask[pos + j])file_data[pos + j] = file_data[pos - copy_offset + j];
-                    }
-                    break;
-                }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    log() << "Corruption completed in " << duration.count() << "ms" << std::endl;
+}
 
-            }
+size_t AVICorruptor::stageGlitches(const CorruptionStage& stage) const {
+    return static_cast<size_t>(stage.intensity * frmcount);
+}
 
-            processed += chunk;
-            double progress = (static_cast<double>(processed) / target_glitches) * 100.0;
-            std::cout << "\rProgress: " << std::fixed << std::setprecision(1)
-                << progress << "%" << std::flush;
-        }
-        std::cout << std::endl;
+void AVICorruptor::planGlitch(Glitch& g, GlitchRandom& r, uint8_t* operand) {
+    int stage_idx = g.stage > 6 ? 6 : g.stage;
+    // 随机破坏方式
+    g.op = (int16_t)r.between(min(0, stage_idx - 2), stage_idx);
+    switch (g.op) {
+    case 0:     // substituted nibbles
+    case 3:     // shift direction
+    case 5:     // noise
+        r.fillBytes(operand, g.len);
+        break;
+    case 6:
+        // copying from previous location, read before any glitch lands
+        gatherCopySource(g, r, 5000, 50000, operand);
+        break;
     }
+}
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    std::cout << "Corruption completed in " << duration.count() << "ms" << std::endl;
+void AVICorruptor::applyGlitch(const Glitch& g, const uint8_t* operand) {
+    using namespace GlitchKernels;
+    uint8_t* p = file_data.data() + g.pos;
+    switch (g.op) {
+    case 0:
+        //bits random substitution
+        runKernel(Substitute{ 0xF0 }, p, operand, g.len);
+        break;
+    case 1:
+        // set to 0x80 (gray)
+        runKernel(Fill{ 0x80 }, p, operand, g.len);
+        break;
+    case 2:
+        // invert color
+        runKernel(Negate{}, p, operand, g.len);
+        break;
+    case 3:
+        // shift
+        runKernel(Shift{ 1 + int(stages[g.stage].intensity * 6) }, p, operand, g.len);
+        break;
+    case 4:
+        // lag simulation
+        runKernel(Fill{ p[0] }, p, operand, g.len);
+        break;
+    case 5:
+        // voltage spike / random noise
+        runKernel(Noise{ g.pos }, p, operand, g.len);
+        break;
+    case 6:
+        // copying from previous location, gathered by planGlitch
+        runKernel(Copy{}, p, operand, g.len);
+        break;
+    }
 }
 
 void AVICorruptor::printFileInfo() {
-    std::cout << "Stages: " << stages.size() << std::endl;
+    log() << "Stages: " << stages.size() << std::endl;
     for (size_t i = 0; i < stages.size(); ++i) {
-        std::cout << "Stage " << (i + 1) << ": "
+        log() << "Stage " << (i + 1) << ": "
             << stages[i].start_ratio * 100 << "% - "
             << stages[i].end_ratio * 100 << "% intensity "
             << stages[i].intensity * 100 << "%" << std::endl;
     }
-    std::cout << "Protected regions:" << std::endl;
-    std::cout << "- Header: " << AVI_HEADER_PROTECT_SIZE << " bytes" << std::endl;
-    std::cout << "- Tail: " << AVI_TAIL_PROTECT_SIZE << " bytes" << std::endl;
-    std::cout << "- Frame headers: " << AVI_FRAME_HEADER_SIZE << " bytes" << std::endl;
-    std::cout << "- idx1 list: see idx1 list detection" << std::endl;
+    log() << "Protected regions:" << std::endl;
+    if (analysis_cached) {
+        log() << "- From " << AnalysisIndex::sidecarPath(source_name) << " (" << frame_starts.size() << " "
+            << (has_riff_index ? "indexed chunks" : "scanned frame markers") << ")" << std::endl;
+    }
+    else if (has_riff_index) {
+        log() << "- Index: " << AVIRiffParser::indexSourceName(riff_parser.getIndexSource())
+            << " (" << riff_parser.getChunks().size() << " chunks, avih frames " << riff_parser.getTotalFrames() << ")" << std::endl;
+        log() << "- Everything outside chunk payloads (headers, hdrl, indexes, padding)" << std::endl;
+    }
+    else {
+        log() << "- Header: " << AVI_HEADER_PROTECT_SIZE << " bytes" << std::endl;
+        log() << "- Tail: " << AVI_TAIL_PROTECT_SIZE << " bytes" << std::endl;
+        log() << "- idx1 list: see idx1 list detection" << std::endl;
+    }
+    log() << "- Frame headers: " << AVI_FRAME_HEADER_SIZE << " bytes" << std::endl;
+    log() << "- Total protected: " << protected_ranges.coveredBytes() << " bytes" << std::endl;
 }
\ No newline at end of file
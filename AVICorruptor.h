@@ -4,6 +4,9 @@
 #include <iostream>
 #include <fstream>
 #include"VideoCorruptor.h"
+#include"SignatureScanner.h"
+#include"PositionSampler.h"
+#include"AVIRiffParser.h"
 #include <algorithm>
 #include <iomanip>
 
@@ -12,7 +15,14 @@
 #define AVI_TAIL_PROTECT_SIZE 150000
 #define AVI_MOVI_LIST_PROTECT_SIZE 8192    // 保护movi列表头8KB
 #define AVI_FRAME_HEADER_SIZE 128          // 保护视频帧头128B           
-#define AVI_PROGRESS_REPORT_INTERVAL 100     //report every 100 glitches
+
+// signature types reported by the scanner
+enum AVISignature : uint32_t {
+    AVI_SIG_CHUNK = 0,  // RIFF, hdrl, avih, strl, strh, strf, strd, movi, JUNK
+    AVI_SIG_LIST,       // LIST
+    AVI_SIG_IDX1,       // idx1
+    AVI_SIG_FRAME       // [01][01][dw][cb] stream chunk ids
+};
 
 /**
 *  AVICorruptor
@@ -22,13 +32,33 @@
 */
 class AVICorruptor:virtual public VideoCorruptor{
 private:
+    SignatureScanner scanner;
+    // all signature hits of the loaded file, sorted by offset
+    vector<SignatureScanner::Hit> scan_hits;
+    // scan_hits were collected while the file was still loading
+    bool early_scan = false;
+    AVIRiffParser riff_parser;
+    // stream chunks were located through the RIFF structure, no scan needed
+    bool has_riff_index;
+    // analysis result used by applyCorruption, computed or loaded from the sidecar
+    vector<size_t> frame_starts;
+    size_t window_begin;
+    size_t window_end;
 
     vector<size_t> findPotentialFrameStarts() override;
+    //protection from the chunk table: everything but the chunk payloads
+    void protectFromRiffIndex();
+    //byte range the stages are spread over
+    void glitchWindow(size_t& begin, size_t& end) const;
+
+    size_t stageGlitches(const CorruptionStage& stage) const override;
+    void planGlitch(Glitch& g, GlitchRandom& r, uint8_t* operand) override;
+    void applyGlitch(const Glitch& g, const uint8_t* operand) override;
     //pre-compute protected mask
     void precomputeProtectedMask() override;
 
 public:
-    AVICorruptor() : VideoCorruptor() {
+    AVICorruptor() : VideoCorruptor(), has_riff_index(false), window_begin(0), window_end(0) {
         //start_ratio, end_ratio, intensity, burst_size
         stages= {
         {0.0, 0.1, 0.01,2},
@@ -39,9 +69,28 @@ public:
         {0.75, 0.85, 0.3,30},
         {0.85, 1.00, 0.7,60}
         };
+        addSignatures(scanner);
     }
 
-    bool loadFile(const string& filename) override;
+    //the signatures of the fallback scan
+    static void addSignatures(SignatureScanner& scanner) {
+        const char* chunk_signatures[] = { "RIFF", "hdrl", "avih", "strl", "strh", "strf", "strd", "movi", "JUNK" };
+        for (const char* sig : chunk_signatures) {
+            scanner.addPattern(AVI_SIG_CHUNK, sig, 4);
+        }
+        scanner.addPattern(AVI_SIG_LIST, "LIST", 4);
+        scanner.addPattern(AVI_SIG_IDX1, "idx1", 4);
+        // frame markers: 00dc, 01wb, 00db, ...
+        const uint8_t frame_mask[] = { 0xFE, 0xFE, 0xFF, 0xFE };
+        const uint8_t frame_d[] = { '0', '0', 'd', 'b' };
+        const uint8_t frame_w[] = { '0', '0', 'w', 'b' };
+        scanner.addPattern(AVI_SIG_FRAME, frame_d, frame_mask, 4);
+        scanner.addPattern(AVI_SIG_FRAME, frame_w, frame_mask, 4);
+    }
+
+    bool readFile(const string& filename) override;
+
+    bool analyze() override;
 
     bool saveFile(const string& filename) override;
 
@@ -0,0 +1,206 @@
+// AVIRiffParser.cpp
+#include "AVIRiffParser.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    const uint32_t FCC_RIFF = AVI_FOURCC('R', 'I', 'F', 'F');
+    const uint32_t FCC_LIST = AVI_FOURCC('L', 'I', 'S', 'T');
+    const uint32_t FCC_AVI = AVI_FOURCC('A', 'V', 'I', ' ');
+    const uint32_t FCC_AVIX = AVI_FOURCC('A', 'V', 'I', 'X');
+    const uint32_t FCC_MOVI = AVI_FOURCC('m', 'o', 'v', 'i');
+    const uint32_t FCC_HDRL = AVI_FOURCC('h', 'd', 'r', 'l');
+    const uint32_t FCC_STRL = AVI_FOURCC('s', 't', 'r', 'l');
+    const uint32_t FCC_AVIH = AVI_FOURCC('a', 'v', 'i', 'h');
+    const uint32_t FCC_INDX = AVI_FOURCC('i', 'n', 'd', 'x');
+    const uint32_t FCC_IDX1 = AVI_FOURCC('i', 'd', 'x', '1');
+
+    // bIndexType values of OpenDML indexes
+    const uint8_t AVI_INDEX_OF_INDEXES = 0x00;
+    const uint8_t AVI_INDEX_OF_CHUNKS = 0x01;
+
+    bool isDigit(uint8_t c) { return c >= '0' && c <= '9'; }
+    bool isLower(uint8_t c) { return c >= 'a' && c <= 'z'; }
+}
+
+bool AVIRiffParser::isStreamChunk(uint32_t id) {
+    return isDigit(uint8_t(id)) && isDigit(uint8_t(id >> 8)) && isLower(uint8_t(id >> 16)) && isLower(uint8_t(id >> 24));
+}
+
+const char* AVIRiffParser::indexSourceName(IndexSource source) {
+    switch (source) {
+    case INDEX_OPENDML: return "OpenDML indx";
+    case INDEX_IDX1: return "idx1";
+    case INDEX_MOVI_WALK: return "movi walk";
+    default: return "none";
+    }
+}
+
+bool AVIRiffParser::chunkAt(uint64_t offset, uint32_t id) const {
+    return offset + 8 <= size && readU32(data + offset) == id;
+}
+
+bool AVIRiffParser::parse(const uint8_t* buffer, size_t length) {
+    data = buffer;
+    size = length;
+    chunks.clear();
+    movi_lists.clear();
+    super_indexes.clear();
+    idx1_offset = 0;
+    idx1_size = 0;
+    total_frames = 0;
+    segments = 0;
+    index_source = INDEX_NONE;
+
+    // RIFF AVI followed by any number of RIFF AVIX segments
+    uint64_t offset = 0;
+    while (offset + 12 <= size && readU32(data + offset) == FCC_RIFF) {
+        uint32_t riff_size = readU32(data + offset + 4);
+        uint32_t form = readU32(data + offset + 8);
+        if (form != (segments == 0 ? FCC_AVI : FCC_AVIX)) break;
+        uint64_t end = min<uint64_t>(offset + 8 + (uint64_t)riff_size, size);
+        walkList(offset + 12, end);
+        segments++;
+        offset = end + (riff_size & 1);
+    }
+    if (segments == 0) return false;
+
+    if (readOpenDML()) {
+        index_source = INDEX_OPENDML;
+    }
+    else if (readIdx1()) {
+        index_source = INDEX_IDX1;
+        // idx1 only covers the first segment
+        walkMovi(1);
+    }
+    else {
+        walkMovi(0);
+        index_source = chunks.empty() ? INDEX_NONE : INDEX_MOVI_WALK;
+    }
+
+    sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) {
+        return a.offset < b.offset;
+    });
+    chunks.erase(unique(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) {
+        return a.offset == b.offset;
+    }), chunks.end());
+    return true;
+}
+
+void AVIRiffParser::walkList(uint64_t begin, uint64_t end) {
+    uint64_t offset = begin;
+    while (offset + 8 <= end) {
+        uint32_t id = readU32(data + offset);
+        uint32_t chunk_size = readU32(data + offset + 4);
+        uint64_t chunk_end = min<uint64_t>(offset + 8 + (uint64_t)chunk_size, end);
+        if (id == FCC_LIST && offset + 12 <= end) {
+            uint32_t list_type = readU32(data + offset + 8);
+            if (list_type == FCC_MOVI) {
+                movi_lists.push_back({ offset + 12, chunk_end });
+            }
+            else if (list_type == FCC_HDRL || list_type == FCC_STRL) {
+                walkList(offset + 12, chunk_end);
+            }
+        }
+        else if (id == FCC_AVIH && total_frames == 0 && offset + 8 + 20 <= end) {
+            // dwMicroSecPerFrame, dwMaxBytesPerSec, dwPaddingGranularity, dwFlags, dwTotalFrames
+            total_frames = readU32(data + offset + 8 + 16);
+        }
+        else if (id == FCC_INDX) {
+            super_indexes.push_back(offset);
+        }
+        else if (id == FCC_IDX1 && idx1_size == 0) {
+            idx1_offset = offset;
+            idx1_size = (uint32_t)(chunk_end - offset - 8);
+        }
+        offset = offset + 8 + (uint64_t)chunk_size + (chunk_size & 1);
+    }
+}
+
+bool AVIRiffParser::readOpenDML() {
+    for (uint64_t indx : super_indexes) {
+        // wLongsPerEntry, bIndexSubType, bIndexType, nEntriesInUse, dwChunkId, dwReserved[3]
+        if (indx + 8 + 24 > size) continue;
+        const uint8_t* p = data + indx + 8;
+        uint32_t indx_size = readU32(data + indx + 4);
+        uint8_t index_type = p[3];
+        uint64_t entries = min<uint64_t>(readU32(p + 4), AVI_MAX_INDEX_ENTRIES);
+        uint64_t indx_len = min<uint64_t>(indx_size, size - indx - 8);
+        if (index_type != AVI_INDEX_OF_INDEXES || indx_len < 24) continue;
+        entries = min<uint64_t>(entries, (indx_len - 24) / 16);
+
+        for (uint64_t e = 0; e < entries; e++) {
+            // qwOffset, dwSize, dwDuration -> one standard index chunk (ix##)
+            uint64_t ix = readU64(p + 24 + 16 * e);
+            // qwOffset is untrusted, compare without letting it wrap
+            if (ix > size || size - ix < 8 + 24) continue;
+            const uint8_t* q = data + ix + 8;
+            uint64_t ix_len = min<uint64_t>(readU32(data + ix + 4), size - ix - 8);
+            if (q[3] != AVI_INDEX_OF_CHUNKS || ix_len < 24) continue;
+            uint32_t chunk_id = readU32(q + 8);
+            uint64_t base = readU64(q + 12);
+            uint64_t count = min<uint64_t>(readU32(q + 4), AVI_MAX_INDEX_ENTRIES);
+            count = min<uint64_t>(count, (ix_len - 24) / 8);
+            for (uint64_t k = 0; k < count; k++) {
+                // dwOffset points at the payload; bit 31 of dwSize marks non-key frames
+                uint64_t payload = base + readU32(q + 24 + 8 * k);
+                uint32_t chunk_size = readU32(q + 28 + 8 * k) & 0x7FFFFFFF;
+                // so is qwBaseOffset: a sum that wrapped or a chunk past the end is dropped
+                if (payload < base || payload < 8 || payload > size || chunk_size > size - payload) continue;
+                chunks.push_back({ payload - 8, chunk_id, chunk_size });
+            }
+        }
+    }
+    return !chunks.empty();
+}
+
+bool AVIRiffParser::readIdx1() {
+    if (idx1_size < 16 || movi_lists.empty()) return false;
+    const uint8_t* p = data + idx1_offset + 8;
+    uint64_t entries = idx1_size / 16;
+
+    // offsets are relative to the 'movi' FourCC in most files, absolute in some
+    uint64_t movi_fourcc = movi_lists.front().begin - 4;
+    uint64_t base = UINT64_MAX;
+    for (uint64_t e = 0; e < entries && base == UINT64_MAX; e++) {
+        uint32_t id = readU32(p + 16 * e);
+        if (!isStreamChunk(id)) continue;
+        uint64_t off = readU32(p + 16 * e + 8);
+        if (chunkAt(movi_fourcc + off, id)) base = movi_fourcc;
+        else if (chunkAt(off, id)) base = 0;
+        else return false;
+    }
+    if (base == UINT64_MAX) return false;
+
+    for (uint64_t e = 0; e < entries; e++) {
+        // ckid, dwFlags, dwChunkOffset, dwChunkLength
+        uint32_t id = readU32(p + 16 * e);
+        if (!isStreamChunk(id)) continue;
+        uint64_t offset = base + readU32(p + 16 * e + 8);
+        uint32_t chunk_size = readU32(p + 16 * e + 12);
+        if (offset + 8 + chunk_size > size) continue;
+        chunks.push_back({ offset, id, chunk_size });
+    }
+    return !chunks.empty();
+}
+
+void AVIRiffParser::walkMovi(size_t first) {
+    for (size_t m = first; m < movi_lists.size(); m++) {
+        uint64_t offset = movi_lists[m].begin;
+        uint64_t end = movi_lists[m].end;
+        while (offset + 8 <= end) {
+            uint32_t id = readU32(data + offset);
+            uint32_t chunk_size = readU32(data + offset + 4);
+            if (id == FCC_LIST) {
+                // 'rec ' groups: step into the list
+                offset += 12;
+                continue;
+            }
+            if (isStreamChunk(id) && offset + 8 + chunk_size <= size) {
+                chunks.push_back({ offset, id, chunk_size });
+            }
+            offset = offset + 8 + (uint64_t)chunk_size + (chunk_size & 1);
+        }
+    }
+}
@@ -0,0 +1,96 @@
+// AVIRiffParser.h
+#ifndef AVIRIFFPARSER_H
+#define AVIRIFFPARSER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+
+// build a little-endian RIFF FourCC value from four characters
+#define AVI_FOURCC(a, b, c, d) (uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24))
+// upper bound for index entries, guards against absurd counts in damaged files
+#define AVI_MAX_INDEX_ENTRIES (1u << 28)
+
+/**
+*  AVIRiffParser
+* @brief Walks the RIFF/LIST structure of an AVI file and locates every stream data chunk.
+* @details Chunk offsets come from the OpenDML super-index (indx -> ix## standard indexes,
+*  covering RIFF AVIX segments of files over 1 GB) when present, otherwise from the legacy idx1,
+*  otherwise from a sequential walk of the movi lists. Only headers and index entries are read,
+*  so the cost is O(chunks) and independent of the payload size.
+* @author AXIS5 with assistance from LLM
+*/
+class AVIRiffParser {
+public:
+    struct Chunk {
+        uint64_t offset;    // first byte of the 8-byte chunk header
+        uint32_t id;        // FourCC, e.g. 00dc / 01wb
+        uint32_t size;      // payload size
+    };
+
+    struct Region {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    enum IndexSource {
+        INDEX_NONE = 0,
+        INDEX_OPENDML,
+        INDEX_IDX1,
+        INDEX_MOVI_WALK
+    };
+
+    //parse the whole buffer; false if it is not a RIFF AVI file
+    bool parse(const uint8_t* data, size_t size);
+
+    //stream data chunks sorted by offset
+    const vector<Chunk>& getChunks() const { return chunks; }
+
+    //payload ranges of all movi lists (one per RIFF AVI/AVIX segment)
+    const vector<Region>& getMoviLists() const { return movi_lists; }
+
+    //dwTotalFrames of the main AVI header
+    uint32_t getTotalFrames() const { return total_frames; }
+
+    //number of RIFF segments (1 for plain AVI, more for OpenDML)
+    size_t getSegmentCount() const { return segments; }
+
+    IndexSource getIndexSource() const { return index_source; }
+    static const char* indexSourceName(IndexSource source);
+
+    static uint32_t readU32(const uint8_t* p) {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+    static uint64_t readU64(const uint8_t* p) {
+        return uint64_t(readU32(p)) | (uint64_t(readU32(p + 4)) << 32);
+    }
+    static uint16_t readU16(const uint8_t* p) {
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+
+    //is this FourCC a stream data chunk id ("##dc", "##wb", ...)
+    static bool isStreamChunk(uint32_t id);
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    vector<Chunk> chunks;
+    vector<Region> movi_lists;
+    vector<uint64_t> super_indexes;     // offsets of indx chunks
+    uint64_t idx1_offset = 0;
+    uint32_t idx1_size = 0;
+    uint32_t total_frames = 0;
+    size_t segments = 0;
+    IndexSource index_source = INDEX_NONE;
+
+    void walkList(uint64_t begin, uint64_t end);
+    bool readOpenDML();
+    bool readIdx1();
+    //sequential walk of movi lists [first, end), for segments without an index
+    void walkMovi(size_t first);
+    bool chunkAt(uint64_t offset, uint32_t id) const;
+};
+
+#endif // !AVIRIFFPARSER_H
@@ -0,0 +1,247 @@
+// AnalysisIndex.cpp
+#include "AnalysisIndex.h"
+#include "GlitchRandom.h"
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+    const uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ull;
+    const uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+
+    inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    // four independent lanes over 32-byte steps, the tail folded into lane 0
+    uint64_t hashBlock(uint64_t h, const uint8_t* p, size_t n) {
+        uint64_t lane[4] = { h, h ^ HASH_PRIME_1, h ^ HASH_PRIME_2, h + HASH_PRIME_1 + HASH_PRIME_2 };
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            for (int k = 0; k < 4; k++) {
+                uint64_t w;
+                memcpy(&w, p + i + 8 * k, 8);
+                lane[k] = rotl(lane[k] + w * HASH_PRIME_2, 31) * HASH_PRIME_1;
+            }
+        }
+        for (; i < n; i++) lane[0] = rotl(lane[0] ^ (p[i] * HASH_PRIME_1), 11) * HASH_PRIME_2;
+        uint64_t r = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18);
+        return GlitchRandom::mix(r ^ n);
+    }
+
+    void putU32(vector<uint8_t>& out, uint32_t v) {
+        for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void putU64(vector<uint8_t>& out, uint64_t v) {
+        for (int i = 0; i < 8; i++) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void putVarint(vector<uint8_t>& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    // bounds-checked reader over the loaded sidecar
+    struct Reader {
+        const uint8_t* p;
+        const uint8_t* end;
+        bool ok = true;
+
+        uint64_t fixed(int bytes) {
+            if (end - p < bytes) {
+                ok = false;
+                return 0;
+            }
+            uint64_t v = 0;
+            for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+            p += bytes;
+            return v;
+        }
+
+        uint64_t varint() {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (p == end) break;
+                uint8_t b = *p++;
+                v |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80)) return v;
+            }
+            ok = false;
+            return 0;
+        }
+
+        // element count, at least min_bytes each must still be there
+        uint64_t count(size_t min_bytes) {
+            uint64_t n = varint();
+            if (ok && n > (uint64_t)(end - p) / min_bytes) ok = false;
+            return ok ? n : 0;
+        }
+    };
+
+    void putOffsets(vector<uint8_t>& out, const vector<uint64_t>& offsets) {
+        putVarint(out, offsets.size());
+        uint64_t last = 0;
+        for (uint64_t o : offsets) {
+            putVarint(out, o - last);
+            last = o;
+        }
+    }
+
+    bool getOffsets(Reader& in, vector<uint64_t>& offsets) {
+        uint64_t n = in.count(1);
+        offsets.resize((size_t)n);
+        uint64_t last = 0;
+        for (uint64_t i = 0; i < n && in.ok; i++) {
+            last += in.varint();
+            offsets[(size_t)i] = last;
+        }
+        return in.ok;
+    }
+}
+
+bool AnalysisIndex::identify(const string& filename, const uint8_t* data, size_t size, Identity& id) {
+    error_code ec;
+    auto mtime = fs::last_write_time(filename, ec);
+    if (ec) return false;
+    id.size = size;
+    id.mtime = (int64_t)mtime.time_since_epoch().count();
+    id.hash = contentHash(data, size);
+    return true;
+}
+
+uint64_t AnalysisIndex::contentHash(const uint8_t* data, size_t size) {
+    uint64_t h = GlitchRandom::mix(size);
+    if (size <= (size_t)ANALYSIS_HASH_SAMPLES * ANALYSIS_HASH_BLOCK) {
+        return hashBlock(h, data, size);
+    }
+    size_t last = size - ANALYSIS_HASH_BLOCK;
+    for (size_t i = 0; i < ANALYSIS_HASH_SAMPLES; i++) {
+        size_t at = (size_t)((uint64_t)last * i / (ANALYSIS_HASH_SAMPLES - 1));
+        h = hashBlock(h, data + at, ANALYSIS_HASH_BLOCK);
+    }
+    return h;
+}
+
+bool AnalysisIndex::save(const string& filename, const Identity& id) const {
+    vector<uint8_t> out;
+    out.insert(out.end(), ANALYSIS_INDEX_MAGIC, ANALYSIS_INDEX_MAGIC + 4);
+    putU32(out, format);
+    putU64(out, id.size);
+    putU64(out, (uint64_t)id.mtime);
+    putU64(out, id.hash);
+    putU32(out, flags);
+    putU64(out, frame_count);
+
+    putVarint(out, protected_ranges.size());
+    uint64_t last = 0;
+    for (const auto& r : protected_ranges) {
+        putVarint(out, r.begin - last);
+        putVarint(out, r.end - r.begin);
+        last = r.end;
+    }
+    putOffsets(out, frame_starts);
+    putOffsets(out, audio_starts);
+    putVarint(out, regions.size());
+    for (const Region& r : regions) {
+        putU64(out, r.offset);
+        putU64(out, r.size);
+        putU32(out, r.flags);
+    }
+    putVarint(out, nal_units.size());
+    last = 0;
+    for (const NalIndex::Unit& u : nal_units) {
+        putVarint(out, u.offset - last);
+        putVarint(out, u.size);
+        out.push_back(u.type);
+        out.push_back(u.nal_class);
+        out.push_back(u.prefix);
+        last = u.offset;
+    }
+    putU64(out, hashBlock(0, out.data(), out.size()));
+
+    // a reader never sees a half-written sidecar
+    string temp = filename + ".tmp";
+    {
+        ofstream file(temp, ios::binary | ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(out.data()), out.size())) {
+            error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    error_code ec;
+    fs::rename(temp, filename, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool AnalysisIndex::load(const string& filename, const Identity& id, uint32_t expected_format) {
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file) return false;
+    streamoff length = file.tellg();
+    if (length < 64) return false;
+    vector<uint8_t> buf((size_t)length);
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(buf.data()), length)) return false;
+
+    Reader in{ buf.data(), buf.data() + buf.size() - 8 };
+    Reader tail{ buf.data() + buf.size() - 8, buf.data() + buf.size() };
+    if (tail.fixed(8) != hashBlock(0, buf.data(), buf.size() - 8)) return false;
+    if (memcmp(buf.data(), ANALYSIS_INDEX_MAGIC, 4) != 0) return false;
+    in.p += 4;
+    format = (uint32_t)in.fixed(4);
+    uint64_t size = in.fixed(8);
+    int64_t mtime = (int64_t)in.fixed(8);
+    uint64_t hash = in.fixed(8);
+    if (format != expected_format || size != id.size || mtime != id.mtime || hash != id.hash) return false;
+    flags = (uint32_t)in.fixed(4);
+    frame_count = in.fixed(8);
+
+    uint64_t n = in.count(2);
+    protected_ranges.resize((size_t)n);
+    uint64_t last = 0;
+    for (uint64_t i = 0; i < n && in.ok; i++) {
+        uint64_t begin = last + in.varint();
+        last = begin + in.varint();
+        protected_ranges[(size_t)i] = { (size_t)begin, (size_t)last };
+    }
+    if (!getOffsets(in, frame_starts) || !getOffsets(in, audio_starts)) return false;
+    n = in.count(20);
+    regions.resize((size_t)n);
+    bool regions_inside = true;
+    for (uint64_t i = 0; i < n && in.ok; i++) {
+        Region& r = regions[(size_t)i];
+        r.offset = in.fixed(8);
+        r.size = in.fixed(8);
+        r.flags = (uint32_t)in.fixed(4);
+        regions_inside = regions_inside && r.size <= id.size && r.offset <= id.size - r.size;
+    }
+    n = in.count(5);
+    nal_units.resize((size_t)n);
+    uint64_t unit_offset = 0, unit_end = 0;
+    for (uint64_t i = 0; i < n && in.ok; i++) {
+        NalIndex::Unit& u = nal_units[(size_t)i];
+        u.offset = unit_offset + in.varint();
+        u.size = (uint32_t)in.varint();
+        u.type = (uint8_t)in.fixed(1);
+        u.nal_class = (uint8_t)in.fixed(1);
+        u.prefix = (uint8_t)in.fixed(1);
+        unit_offset = u.offset;
+        unit_end = max(unit_end, u.offset + u.size);
+    }
+    // nothing may point past the file
+    auto past_end = [&](uint64_t offset) { return offset > id.size; };
+    if (!in.ok || in.p != in.end || last > id.size || unit_end > id.size || !regions_inside ||
+        any_of(frame_starts.begin(), frame_starts.end(), past_end) ||
+        any_of(audio_starts.begin(), audio_starts.end(), past_end)) return false;
+    return true;
+}
@@ -0,0 +1,79 @@
+// AnalysisIndex.h
+#ifndef ANALYSISINDEX_H
+#define ANALYSISINDEX_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "RangeSet.h"
+#include "NalIndex.h"
+
+using std::vector;
+using std::string;
+
+#define ANALYSIS_INDEX_MAGIC "VCX2"
+#define ANALYSIS_INDEX_SUFFIX ".vcidx"
+// content hash: this many evenly spaced blocks of ANALYSIS_HASH_BLOCK bytes, first and last included
+#define ANALYSIS_HASH_SAMPLES 64
+#define ANALYSIS_HASH_BLOCK (64u << 10)
+
+#define ANALYSIS_FORMAT_AVI 1
+#define ANALYSIS_FORMAT_MP4 2
+
+/**
+*  AnalysisIndex
+* @brief The analysis result of one input file, kept in a sidecar file next to it.
+* @details Everything analyze() derives from the input bytes: protected ranges, frame and audio
+*  frame offsets, the glitch regions (AVI movi window, MP4 mdat table), the MP4 NAL unit index
+*  and the frame count.
+*  The sidecar is keyed by the file identity (size, modification time and a hash of sampled
+*  blocks) and only used while all three match, so an edited or replaced input is analyzed again.
+*
+*  File layout (little-endian, sorted offsets stored as varint deltas):
+*    "VCX2" | u32 format | u64 size | i64 mtime | u64 hash | u32 flags | u64 frame count |
+*    ranges: varint n, (delta begin, length)* | frame starts: varint n, delta* |
+*    audio starts: varint n, delta* | regions: varint n, (u64 offset, u64 size, u32 flags)* |
+*    NAL units: varint n, (delta offset, varint size, u8 type, u8 class, u8 prefix)* |
+*    u64 checksum of everything before
+* @author AXIS5 with assistance from LLM
+*/
+class AnalysisIndex {
+public:
+    struct Identity {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t hash = 0;
+    };
+
+    struct Region {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t flags;     // format specific (MP4: 64-bit box size)
+    };
+
+    uint32_t format = 0;
+    uint32_t flags = 0;             // format specific (structure parsed instead of scanned)
+    uint64_t frame_count = 0;
+    vector<RangeSet::Range> protected_ranges;
+    vector<uint64_t> frame_starts;
+    vector<uint64_t> audio_starts;
+    vector<Region> regions;
+    vector<NalIndex::Unit> nal_units;
+
+    //identity of a file whose bytes are already in memory; false if it cannot be stat'ed
+    static bool identify(const string& filename, const uint8_t* data, size_t size, Identity& id);
+
+    //64-bit hash of ANALYSIS_HASH_SAMPLES blocks spread over the buffer (all of it if small)
+    static uint64_t contentHash(const uint8_t* data, size_t size);
+
+    static string sidecarPath(const string& input) { return input + ANALYSIS_INDEX_SUFFIX; }
+
+    //write atomically (temporary file + rename)
+    bool save(const string& filename, const Identity& id) const;
+
+    //false if the sidecar is missing, damaged, or belongs to another file or format
+    bool load(const string& filename, const Identity& id, uint32_t expected_format);
+};
+
+#endif // !ANALYSISINDEX_H
@@ -0,0 +1,401 @@
+// AsyncFile.cpp
+#include "AsyncFile.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <ios>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+// io_uring needs no library, only the kernel header for the ring layout
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ASYNCFILE_HAS_RING 1
+#endif
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+    atomic<bool> ring_enabled{ true };
+}
+
+void AsyncFile::setRingEnabled(bool enable) {
+    ring_enabled = enable;
+}
+
+#ifdef ASYNCFILE_HAS_RING
+// submission and completion rings shared with the kernel, only the ring thread touches them
+struct AsyncFile::Ring {
+    int fd = -1;
+    void* sq_map = MAP_FAILED;
+    size_t sq_len = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_len = 0;
+    void* sqe_map = MAP_FAILED;
+    size_t sqe_len = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    // one slot per request in flight, user_data is the slot
+    iovec iov[ASYNC_IO_DEPTH];
+    Request* slot_request[ASYNC_IO_DEPTH];
+    unsigned free_slots[ASYNC_IO_DEPTH];
+    unsigned free_count = 0;
+
+    ~Ring() {
+        if (sqe_map != MAP_FAILED) munmap(sqe_map, sqe_len);
+        if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_len);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_len);
+        if (fd >= 0) close(fd);
+    }
+
+    bool setup() {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, ASYNC_IO_DEPTH, &p);
+        if (fd < 0) return false;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_map = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        single_map = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+        if (single_map) sq_len = cq_len = max(sq_len, cq_len);
+        sq_map = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED) return false;
+        cq_map = single_map ? sq_map
+            : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) return false;
+        sqe_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqe_map = mmap(nullptr, sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqe_map == MAP_FAILED) return false;
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_map);
+        uint8_t* cq = static_cast<uint8_t*>(cq_map);
+        sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        sqes = static_cast<io_uring_sqe*>(sqe_map);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        for (unsigned i = 0; i < ASYNC_IO_DEPTH; i++) free_slots[free_count++] = ASYNC_IO_DEPTH - 1 - i;
+        return true;
+    }
+
+    //put the untransferred rest of r on the submission ring
+    void push(Request& r, bool write, int file) {
+        unsigned slot = free_slots[--free_count];
+        slot_request[slot] = &r;
+        iov[slot].iov_base = r.buffer + r.done;
+        iov[slot].iov_len = r.len - r.done;
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe& e = sqes[index];
+        memset(&e, 0, sizeof(e));
+        e.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        e.fd = file;
+        e.off = r.offset + r.done;
+        e.addr = (uint64_t)(uintptr_t)&iov[slot];
+        e.len = 1;
+        e.user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    //submit and wait for at least wait completions; submitted count or -errno
+    int enter(unsigned submit, unsigned wait) {
+        int n = (int)syscall(__NR_io_uring_enter, fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        return n < 0 ? -errno : n;
+    }
+};
+#else
+struct AsyncFile::Ring {};
+#endif
+
+AsyncFile::AsyncFile() = default;
+
+AsyncFile::~AsyncFile() {
+    finish();
+}
+
+bool AsyncFile::open(const string& filename, Mode m) {
+    finish();
+    mode = m;
+    name = filename;
+    requests.clear();
+    next_request = first_open = 0;
+    done_end = 0;
+    closing = error = false;
+    error_text.clear();
+    file_size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    stream.open(filename, ios::binary | (mode == READ ? ios::in : ios::out | ios::trunc));
+    if (!stream) return false;
+    if (mode == READ) {
+        stream.seekg(0, ios::end);
+        streamoff size = stream.tellg();
+        if (size < 0) {
+            stream.close();
+            return false;
+        }
+        file_size = (uint64_t)size;
+    }
+    workers.emplace_back(&AsyncFile::threadLoop, this);
+#else
+    fd = mode == READ ? ::open(filename.c_str(), O_RDONLY) : ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        closeFile();
+        return false;
+    }
+    file_size = (uint64_t)st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+    // requests run side by side, a wider readahead window keeps the disk reading sequentially
+    if (mode == READ) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef ASYNCFILE_HAS_RING
+    if (ring_enabled) {
+        ring.reset(new Ring());
+        if (!ring->setup()) ring.reset();
+    }
+#endif
+    if (ring) {
+        workers.emplace_back(&AsyncFile::ringLoop, this);
+    }
+    else {
+        for (int i = 0; i < ASYNC_IO_THREADS; i++) workers.emplace_back(&AsyncFile::threadLoop, this);
+    }
+#endif
+    return true;
+}
+
+void AsyncFile::transfer(uint64_t offset, uint8_t* buffer, uint64_t len) {
+    if (len == 0) return;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        // with nothing pending the completed prefix ends where this transfer starts
+        if (first_open == requests.size()) done_end = offset;
+        // cut at chunk boundaries of the file, so requests stay aligned whatever the caller queues
+        uint64_t pos = 0;
+        while (pos < len) {
+            uint64_t at = offset + pos;
+            uint64_t n = min<uint64_t>(len - pos, ASYNC_IO_CHUNK - at % ASYNC_IO_CHUNK);
+            requests.push_back({ at, buffer + pos, (uint32_t)n, 0, false });
+            pos += n;
+        }
+    }
+    work.notify_all();
+}
+
+uint64_t AsyncFile::done() const {
+    lock_guard<std::mutex> lock(mutex);
+    return done_end;
+}
+
+uint64_t AsyncFile::waitFor(uint64_t end) {
+    unique_lock<std::mutex> lock(mutex);
+    progress.wait(lock, [&] { return done_end >= end || first_open == requests.size() || error; });
+    return done_end;
+}
+
+bool AsyncFile::failed() const {
+    lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+string AsyncFile::errorText() const {
+    lock_guard<std::mutex> lock(mutex);
+    return error_text;
+}
+
+const char* AsyncFile::backendName() const {
+    return ring ? "io_uring" : "threads";
+}
+
+bool AsyncFile::finish() {
+    if (workers.empty()) return !error;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    work.notify_all();
+    for (auto& t : workers) t.join();
+    workers.clear();
+    ring.reset();
+    closeFile();
+    return !error;
+}
+
+void AsyncFile::closeFile() {
+#if defined(_WIN32) || defined(_WIN64)
+    if (!stream.is_open()) return;
+    stream.close();
+    if (stream.fail() && !error) {
+        error = true;
+        error_text = "close failed";
+    }
+#else
+    if (fd < 0) return;
+    if (close(fd) != 0 && !error) {
+        error = true;
+        error_text = strerror(errno);
+    }
+    fd = -1;
+#endif
+}
+
+void AsyncFile::complete(Request& r, const string& failure) {
+    if (!failure.empty()) {
+        if (!error) {
+            error = true;
+            error_text = failure;
+        }
+    }
+    else {
+        r.finished = true;
+        while (first_open < requests.size() && requests[first_open].finished) {
+            done_end = requests[first_open].offset + requests[first_open].len;
+            first_open++;
+        }
+    }
+    progress.notify_all();
+}
+
+string AsyncFile::transferBlocking(Request& r) {
+#if defined(_WIN32) || defined(_WIN64)
+    // one worker thread owns the stream
+    if (mode == READ) {
+        stream.seekg((streamoff)r.offset, ios::beg);
+        if (!stream.read(reinterpret_cast<char*>(r.buffer), r.len)) return "read failed";
+    }
+    else {
+        stream.seekp((streamoff)r.offset, ios::beg);
+        if (!stream.write(reinterpret_cast<const char*>(r.buffer), r.len)) return "write failed";
+    }
+    r.done = r.len;
+    return string();
+#else
+    while (r.done < r.len) {
+        ssize_t n = mode == READ
+            ? pread(fd, r.buffer + r.done, r.len - r.done, (off_t)(r.offset + r.done))
+            : pwrite(fd, r.buffer + r.done, r.len - r.done, (off_t)(r.offset + r.done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return strerror(errno);
+        }
+        if (n == 0) return mode == READ ? "unexpected end of file" : "no bytes written";
+        r.done += (uint32_t)n;
+    }
+    return string();
+#endif
+}
+
+void AsyncFile::threadLoop() {
+    unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        work.wait(lock, [&] { return next_request < requests.size() || closing || error; });
+        if (error || next_request == requests.size()) {
+            if (closing || error) return;
+            continue;
+        }
+        Request& r = requests[next_request++];
+        lock.unlock();
+        string failure = transferBlocking(r);
+        lock.lock();
+        complete(r, failure);
+    }
+}
+
+void AsyncFile::ringLoop() {
+#ifdef ASYNCFILE_HAS_RING
+    Ring& q = *ring;
+    unsigned in_flight = 0;     // on the ring or in the kernel
+    unsigned unsubmitted = 0;   // on the ring, not yet passed to io_uring_enter
+    bool stop = false;
+    for (;;) {
+        {
+            unique_lock<std::mutex> lock(mutex);
+            if (in_flight == 0) {
+                work.wait(lock, [&] { return next_request < requests.size() || closing || error; });
+                if (error || (closing && next_request == requests.size())) return;
+            }
+            // after a failure only the requests already in the kernel are waited for
+            while (!error && in_flight < ASYNC_IO_DEPTH && next_request < requests.size()) {
+                q.push(requests[next_request++], mode == WRITE, fd);
+                in_flight++;
+                unsubmitted++;
+            }
+        }
+        if (stop && in_flight == unsubmitted) return;
+
+        int n = q.enter(unsubmitted, in_flight > unsubmitted ? 1 : 0);
+        if (n >= 0) {
+            unsubmitted -= (unsigned)n;
+        }
+        else if (n != -EINTR && n != -EAGAIN && n != -EBUSY) {
+            lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = true;
+                error_text = strerror(-n);
+            }
+            progress.notify_all();
+            // nothing else can be submitted; wait for what the kernel has, if the ring still works
+            stop = true;
+            if (q.enter(0, in_flight > unsubmitted ? 1 : 0) < 0) return;
+        }
+
+        // reap
+        unsigned head = *q.cq_head;
+        while (head != __atomic_load_n(q.cq_tail, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe& c = q.cqes[head & *q.cq_mask];
+            unsigned slot = (unsigned)c.user_data;
+            int res = c.res;
+            head++;
+            __atomic_store_n(q.cq_head, head, __ATOMIC_RELEASE);
+            Request& r = *q.slot_request[slot];
+            q.free_slots[q.free_count++] = slot;
+            in_flight--;
+
+            lock_guard<std::mutex> lock(mutex);
+            string failure;
+            if (res < 0 && res != -EINTR && res != -EAGAIN) failure = strerror(-res);
+            // a transfer that moves nothing would be resubmitted forever
+            else if (res == 0) failure = mode == READ ? "unexpected end of file" : "no bytes written";
+            else if (res > 0) r.done += (uint32_t)res;
+            if (failure.empty() && r.done < r.len) {
+                // short or interrupted transfer: the rest goes back on the ring
+                if (!error && !stop) {
+                    q.push(r, mode == WRITE, fd);
+                    in_flight++;
+                    unsubmitted++;
+                }
+                continue;
+            }
+            complete(r, failure);
+        }
+        if (stop && in_flight == unsubmitted) return;
+    }
+#endif
+}
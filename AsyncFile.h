@@ -0,0 +1,120 @@
+// AsyncFile.h
+#ifndef ASYNCFILE_H
+#define ASYNCFILE_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+using std::string;
+
+// bytes per request; requests start at multiples of it, except the first of a transfer
+#define ASYNC_IO_CHUNK (32u << 20)
+// requests the io_uring backend keeps in flight: one running, one queued behind it. The page
+// cache reads ahead on its own, more requests at scattered offsets only break its stream up
+#define ASYNC_IO_DEPTH 2
+// worker threads of the fallback backend (one on Windows, where a stream has one position)
+#define ASYNC_IO_THREADS 2
+
+/**
+*  AsyncFile
+* @brief Reads or writes one file in the background, in large chunks, in file order.
+* @details transfer() queues a byte range and returns at once; the requests run on io_uring
+*  (set up with raw syscalls, ASYNC_IO_DEPTH requests in flight) where the kernel offers it,
+*  otherwise on a few threads doing blocking pread/pwrite. done() is the end of the prefix of
+*  the queued range that has completed, so a reader can consume the front of a file while the
+*  rest is still on its way and a writer can keep queueing while earlier chunks are written.
+*  Buffers given to transfer() must stay valid and unchanged until finish() returns.
+* @author AXIS5 with assistance from LLM
+*/
+class AsyncFile {
+public:
+    enum Mode { READ, WRITE };
+
+    AsyncFile();
+    //waits for every queued request
+    ~AsyncFile();
+
+    AsyncFile(const AsyncFile&) = delete;
+    AsyncFile& operator=(const AsyncFile&) = delete;
+
+    //open for reading, or create/truncate for writing, and start the backend
+    bool open(const string& filename, Mode mode);
+
+    //size of the file when it was opened
+    uint64_t fileSize() const { return file_size; }
+
+    const string& fileName() const { return name; }
+
+    //queue buffer[0, len) to or from [offset, offset + len); offsets must follow the previous transfer
+    void transfer(uint64_t offset, uint8_t* buffer, uint64_t len);
+
+    //end of the completed prefix of everything queued
+    uint64_t done() const;
+
+    //block until done() reaches end, everything queued has completed or a request failed; returns done()
+    uint64_t waitFor(uint64_t end);
+
+    //wait for everything queued and close the file; false if any request failed (idempotent)
+    bool finish();
+
+    bool failed() const;
+
+    //description of the first failure
+    string errorText() const;
+
+    //"io_uring" or "threads"
+    const char* backendName() const;
+
+    //let open() pick io_uring when available (default), false forces the thread backend
+    static void setRingEnabled(bool enable);
+
+private:
+    struct Request {
+        uint64_t offset;
+        uint8_t* buffer;
+        uint32_t len;
+        uint32_t done;      // bytes transferred so far, short transfers are continued
+        bool finished;
+    };
+    struct Ring;
+
+    Mode mode = READ;
+    string name;
+    uint64_t file_size = 0;
+    // requests in file order; a deque keeps references valid while the writer appends
+    std::deque<Request> requests;
+    size_t next_request = 0;    // first request not handed to the backend yet
+    size_t first_open = 0;      // first request not finished
+    uint64_t done_end = 0;
+    bool closing = false;
+    bool error = false;
+    string error_text;
+    mutable std::mutex mutex;
+    std::condition_variable work;       // workers: new requests or closing
+    std::condition_variable progress;   // waiters: the prefix grew or a request failed
+    std::vector<std::thread> workers;
+    std::unique_ptr<Ring> ring;         // null on the thread backend
+#if defined(_WIN32) || defined(_WIN64)
+    std::fstream stream;
+#else
+    int fd = -1;
+#endif
+
+    void ringLoop();
+    void threadLoop();
+    //blocking transfer of the rest of r; empty on success, the reason otherwise
+    string transferBlocking(Request& r);
+    //mark r finished (or the run failed) and move the prefix; mutex held
+    void complete(Request& r, const string& failure);
+    void closeFile();
+};
+
+#endif // !ASYNCFILE_H
@@ -0,0 +1,224 @@
+// BatchRunner.cpp
+#include "BatchRunner.h"
+#include "BoundedQueue.h"
+#include "ThreadPool.h"
+#include "MP4Corruptor.h"
+#include "AVICorruptor.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cctype>
+#include <algorithm>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+    // one file travelling through the pipeline
+    struct BatchItem {
+        size_t index = 0;
+        unique_ptr<VideoCorruptor> corruptor;
+        unique_ptr<ostringstream> log;
+    };
+
+    string trim(const string& s) {
+        size_t b = s.find_first_not_of(" \t\r\n");
+        if (b == string::npos) return "";
+        size_t e = s.find_last_not_of(" \t\r\n");
+        return s.substr(b, e - b + 1);
+    }
+}
+
+VideoCorruptor* BatchRunner::createCorruptor(string format) {
+    transform(format.begin(), format.end(), format.begin(), (int (*)(int))tolower);
+    if (format == "avi") return new AVICorruptor();
+    if (format == "mp4") return new MP4Corruptor();
+    return nullptr;
+}
+
+string BatchRunner::formatFromName(const string& filename) {
+    size_t dot = filename.find_last_of('.');
+    if (dot == string::npos) return "";
+    string ext = filename.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), (int (*)(int))tolower);
+    return ext == "avi" || ext == "mp4" ? ext : "";
+}
+
+bool BatchRunner::addManifest(const string& path) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Error opening manifest: " << path << endl;
+        return false;
+    }
+    string line;
+    size_t line_no = 0;
+    while (getline(in, line)) {
+        line_no++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        vector<string> fields;
+        char sep = line.find('\t') != string::npos ? '\t' : ' ';
+        istringstream fields_in(line);
+        string field;
+        while (getline(fields_in, field, sep)) {
+            field = trim(field);
+            if (!field.empty()) fields.push_back(field);
+        }
+        if (fields.size() < 2 || fields.size() > 3) {
+            cerr << "Manifest line " << line_no << ": expected <input> <output> [format]" << endl;
+            return false;
+        }
+        Job job{ fields[0], fields[1], fields.size() == 3 ? fields[2] : formatFromName(fields[0]) };
+        if (job.format.empty()) {
+            cerr << "Manifest line " << line_no << ": unknown format of " << job.input << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool BatchRunner::addDirectory(const string& dir, const string& out_dir) {
+    error_code ec;
+    vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && !formatFromName(entry.path().filename().string()).empty()) {
+            files.push_back(entry.path());
+        }
+    }
+    if (ec) {
+        cerr << "Error reading directory: " << dir << endl;
+        return false;
+    }
+    fs::create_directories(out_dir, ec);
+    if (ec) {
+        cerr << "Error creating output directory: " << out_dir << endl;
+        return false;
+    }
+    sort(files.begin(), files.end());
+    for (const auto& f : files) {
+        jobs.push_back({ f.string(), (fs::path(out_dir) / f.filename()).string(), formatFromName(f.filename().string()) });
+    }
+    return true;
+}
+
+size_t BatchRunner::run(const Options& options) {
+    size_t workers = options.jobs ? options.jobs : ThreadPool::hardwareThreads();
+    BoundedQueue<BatchItem> loaded(workers * BATCH_QUEUE_DEPTH);
+    BoundedQueue<BatchItem> corrupted(workers * BATCH_QUEUE_DEPTH);
+    atomic<size_t> next_job(0);
+    atomic<size_t> failed(0);
+    atomic<size_t> finished(0);
+    mutex print_mutex;
+    // one JSON object per job, in job order
+    vector<string> job_metrics(options.metrics_file.empty() ? 0 : jobs.size());
+
+    auto finish = [&](BatchItem& item, bool ok) {
+        size_t done = ++finished;
+        const Job& job = jobs[item.index];
+        if (!job_metrics.empty()) {
+            ostringstream json;
+            json << "{ \"input\": " << CorruptionMetrics::quote(job.input)
+                << ", \"output\": " << CorruptionMetrics::quote(job.output)
+                << ", \"ok\": " << (ok ? "true" : "false") << ", \"metrics\": ";
+            if (item.corruptor) item.corruptor->getMetrics().writeJSON(json, "  ");
+            else json << "null";
+            json << " }";
+            job_metrics[item.index] = json.str();
+        }
+        if (!ok) failed++;
+        if (options.quiet && ok) {
+            item.corruptor.reset();
+            return;
+        }
+        lock_guard<mutex> lock(print_mutex);
+        cout << "[" << done << "/" << jobs.size() << "] " << job.input << " -> " << job.output
+            << (ok ? "" : " FAILED") << endl;
+        if (item.log) cout << item.log->str();
+        item.corruptor.reset();
+    };
+
+    // read stage: the CPU workers never wait for a disk
+    auto reader = [&]() {
+        size_t i;
+        while ((i = next_job++) < jobs.size()) {
+            BatchItem item;
+            item.index = i;
+            item.log.reset(new ostringstream());
+            item.corruptor.reset(createCorruptor(jobs[i].format));
+            if (!item.corruptor) {
+                *item.log << "Unsupported format: " << jobs[i].format << endl;
+                finish(item, false);
+                continue;
+            }
+            item.corruptor->setLog(item.log.get());
+            item.corruptor->setMemoryMapped(options.use_mmap);
+            item.corruptor->setAnalysisCache(options.use_cache);
+            item.corruptor->setThreads(options.threads);
+            if (options.has_seed) item.corruptor->setSeed(options.seed + i);
+            if (options.target) item.corruptor->setTarget(options.target);
+            // readFile only starts a background read, finishRead completes it here
+            if (!item.corruptor->readFile(jobs[i].input) || !item.corruptor->finishRead()) {
+                finish(item, false);
+                continue;
+            }
+            loaded.push(std::move(item));
+        }
+    };
+
+    // CPU stage: protection analysis, then corruption
+    auto worker = [&]() {
+        BatchItem item;
+        while (loaded.pop(item)) {
+            if (!item.corruptor->analyze()) {
+                finish(item, false);
+                continue;
+            }
+            item.corruptor->printFileInfo();
+            item.corruptor->applyCorruption();
+            corrupted.push(std::move(item));
+        }
+    };
+
+    // save stage
+    auto saver = [&]() {
+        BatchItem item;
+        while (corrupted.pop(item)) {
+            bool ok = item.corruptor->saveFile(jobs[item.index].output);
+            finish(item, ok);
+        }
+    };
+
+    vector<thread> readers, cpu, savers;
+    for (size_t i = 0; i < BATCH_IO_THREADS; i++) readers.emplace_back(reader);
+    for (size_t i = 0; i < workers; i++) cpu.emplace_back(worker);
+    for (size_t i = 0; i < BATCH_IO_THREADS; i++) savers.emplace_back(saver);
+
+    // close each queue once all of its producers are done
+    for (auto& t : readers) t.join();
+    loaded.close();
+    for (auto& t : cpu) t.join();
+    corrupted.close();
+    for (auto& t : savers) t.join();
+
+    if (!job_metrics.empty()) {
+        ofstream out_file;
+        if (options.metrics_file != "-") {
+            out_file.open(options.metrics_file, ios::trunc);
+            if (!out_file) cerr << "Error creating metrics file: " << options.metrics_file << endl;
+        }
+        ostream& out = options.metrics_file == "-" ? cout : out_file;
+        out << "[";
+        for (size_t i = 0; i < job_metrics.size(); i++) {
+            out << (i ? ",\n  " : "\n  ") << job_metrics[i];
+        }
+        out << "\n]" << endl;
+    }
+    return failed;
+}
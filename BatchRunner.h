@@ -0,0 +1,71 @@
+// BatchRunner.h
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "VideoCorruptor.h"
+
+using std::string;
+using std::vector;
+
+// threads of each I/O stage (read, save)
+#define BATCH_IO_THREADS 2
+// files waiting between two stages, per CPU worker
+#define BATCH_QUEUE_DEPTH 2
+
+/**
+*  BatchRunner
+* @brief Corrupts many files as a pipeline: read -> analyze + corrupt -> save.
+* @details Jobs come from a manifest (one "input output [format]" per line) or from every AVI/MP4
+*  file of a directory. Reading and saving run on BATCH_IO_THREADS threads each, analysis and
+*  corruption run back to back on the CPU workers. The stages are linked by bounded queues, so
+*  disks and cores are busy at the same time while at most a few files per worker are in memory.
+*  Each job logs into its own buffer, printed in one piece when the job is finished.
+* @author AXIS5 with assistance from LLM
+*/
+class BatchRunner {
+public:
+    struct Job {
+        string input;
+        string output;
+        string format;  // "avi" or "mp4"
+    };
+
+    struct Options {
+        bool use_mmap = false;
+        bool use_cache = false;     // analysis sidecars next to the inputs
+        bool has_seed = false;
+        uint64_t seed = 0;      // job i uses seed + i
+        size_t threads = 1;     // glitch threads per file
+        size_t jobs = 0;        // CPU workers, 0 = one per hardware thread
+        bool quiet = false;     // only failures are reported
+        string metrics_file;    // JSON array with the metrics of every job, empty = none
+        unsigned target = 0;    // NAL unit classes every stage aims at (MP4), 0 = whole windows
+    };
+
+    //read jobs from a manifest file; lines starting with # are comments,
+    //fields are separated by tabs, or by spaces if the line has no tab
+    bool addManifest(const string& path);
+
+    //one job per AVI/MP4 file in dir, written to out_dir under the same name
+    bool addDirectory(const string& dir, const string& out_dir);
+
+    const vector<Job>& getJobs() const { return jobs; }
+
+    //run all jobs, returns the number of failed ones
+    size_t run(const Options& options);
+
+    //corruptor for a format name ("avi", "MP4", ...), nullptr if unsupported
+    static VideoCorruptor* createCorruptor(string format);
+
+    //format from the file extension, empty if unknown
+    static string formatFromName(const string& filename);
+
+private:
+    vector<Job> jobs;
+};
+
+#endif // !BATCHRUNNER_H
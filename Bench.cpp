@@ -0,0 +1,458 @@
+// Bench.cpp: VideoCorruptorBench, throughput of every pipeline stage on synthetic inputs
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <filesystem>
+#include <cstring>
+#include "SyntheticMedia.h"
+#include "BatchRunner.h"
+#include "AVICorruptor.h"
+#include "MP4Corruptor.h"
+#include "PositionSampler.h"
+#include "AsyncFile.h"
+#include "ThreadPool.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+    // the operation benchmarks run over at most this many bytes of the input
+    const size_t BENCH_KERNEL_SLICE = 256u << 20;
+
+    struct BenchOptions {
+        SyntheticMedia::Options media;
+        size_t burst = 32;
+        int repeat = 3;
+        size_t threads = 0;
+        string dir;
+        bool keep = false;
+        bool large = false;     // inputs beyond memory: mmap only, one run per stage, verify the output
+        bool check = false;     // self-test instead of timings
+    };
+
+    // fastest of repeat runs in ms
+    template<class F>
+    double bestOf(int repeat, F fn) {
+        double best = 1e300;
+        for (int i = 0; i < repeat; i++) {
+            auto start = chrono::steady_clock::now();
+            fn();
+            auto end = chrono::steady_clock::now();
+            best = min(best, chrono::duration<double, milli>(end - start).count());
+        }
+        return best;
+    }
+
+    void report(const string& stage, double amount, double ms, const char* unit) {
+        double rate = ms > 0 ? amount / (ms / 1000.0) : 0;
+        cout << "  " << left << setw(26) << stage << right << fixed << setprecision(2)
+            << setw(10) << ms << " ms" << setw(12) << rate << " " << unit << endl;
+    }
+
+    void reportBytes(const string& stage, uint64_t bytes, double ms) {
+        report(stage, bytes / 1048576.0, ms, "MB/s");
+    }
+
+    // protected ranges the way analyze builds them from the frame offsets: header, frame headers, tail
+    RangeSet frameHeaderRanges(const vector<size_t>& frame_starts, size_t header, size_t size) {
+        RangeSet ranges;
+        ranges.add(0, min(header, size));
+        for (size_t pos : frame_starts) ranges.add(pos, min(pos + header, size));
+        ranges.normalize();
+        return ranges;
+    }
+
+    template<class Kernel>
+    void benchKernel(const string& name, const Kernel& k, vector<uint8_t>& work, const vector<uint8_t>& operand,
+        size_t burst, int repeat) {
+        double ms = bestOf(repeat, [&]() {
+            uint8_t* p = work.data();
+            for (size_t pos = 0; pos + burst <= work.size(); pos += burst) {
+                GlitchKernels::runKernel(k, p + pos, operand.data(), burst);
+            }
+        });
+        reportBytes("op " + name, work.size(), ms);
+    }
+
+    // Noise depends on the file offset of the burst
+    void benchNoise(vector<uint8_t>& work, const vector<uint8_t>& operand, size_t burst, int repeat) {
+        double ms = bestOf(repeat, [&]() {
+            uint8_t* p = work.data();
+            for (size_t pos = 0; pos + burst <= work.size(); pos += burst) {
+                GlitchKernels::runKernel(GlitchKernels::Noise{ pos }, p + pos, operand.data(), burst);
+            }
+        });
+        reportBytes("op noise", work.size(), ms);
+    }
+
+    // read every page of a mapping, a mapping alone costs nothing
+    void touchPages(const FileBuffer& buffer) {
+        volatile uint8_t sink = 0;
+        for (size_t i = 0; i < buffer.size(); i += 4096) sink ^= buffer[i];
+    }
+
+    // large-file check: the structure of the output is the one of the input, and the glitches
+    // reach the end of the file instead of wrapping around below 4 GiB
+    bool verifyLarge(const string& format, const string& input, const string& output) {
+        FileBuffer in, out;
+        if (!in.loadMapped(input) || !out.loadMapped(output)) return false;
+        if (in.size() != out.size()) {
+            cerr << "verify: output size " << out.size() << " != input size " << in.size() << endl;
+            return false;
+        }
+        bool same_structure;
+        if (format == "avi") {
+            AVIRiffParser a, b;
+            a.parse(in.data(), in.size());
+            b.parse(out.data(), out.size());
+            same_structure = !a.getChunks().empty() && a.getChunks().size() == b.getChunks().size() &&
+                equal(a.getChunks().begin(), a.getChunks().end(), b.getChunks().begin(),
+                    [](const AVIRiffParser::Chunk& x, const AVIRiffParser::Chunk& y) {
+                        return x.offset == y.offset && x.id == y.id && x.size == y.size;
+                    });
+        }
+        else {
+            MP4BoxParser a, b;
+            a.parse(in.data(), in.size());
+            b.parse(out.data(), out.size());
+            same_structure = a.hasSampleTables() && a.getTracks().size() == b.getTracks().size();
+            for (size_t t = 0; same_structure && t < a.getTracks().size(); t++) {
+                const auto& x = a.getTracks()[t].samples;
+                const auto& y = b.getTracks()[t].samples;
+                same_structure = x.size() == y.size() && equal(x.begin(), x.end(), y.begin(),
+                    [](const MP4BoxParser::Sample& p, const MP4BoxParser::Sample& q) {
+                        return p.offset == q.offset && p.size == q.size;
+                    });
+            }
+        }
+
+        // changed bytes per 4 GiB band, and in the last eighth of the file where the stages are densest
+        vector<uint64_t> changed((in.size() >> 32) + 1, 0);
+        uint64_t tail_changed = 0;
+        size_t tail = in.size() - in.size() / 8;
+        for (size_t block = 0; block < in.size(); block += 4096) {
+            size_t n = min<size_t>(4096, in.size() - block);
+            if (memcmp(in.data() + block, out.data() + block, n) == 0) continue;
+            for (size_t i = block; i < block + n; i++) {
+                if (in[i] == out[i]) continue;
+                changed[i >> 32]++;
+                if (i >= tail) tail_changed++;
+            }
+        }
+        cout << "  (changed bytes per 4 GiB:";
+        for (uint64_t c : changed) cout << " " << c;
+        cout << "; structure " << (same_structure ? "intact" : "BROKEN") << ")" << endl;
+        return same_structure && tail_changed > 0;
+    }
+
+    bool sameFile(const string& a, const string& b) {
+        FileBuffer x, y;
+        if (!x.loadMapped(a) || !y.loadMapped(b)) return false;
+        return x.size() == y.size() && memcmp(x.data(), y.data(), x.size()) == 0;
+    }
+
+    // one corruption of input into output, optionally recorded into a journal file
+    bool corruptOnce(const string& format, const string& input, const string& output, const string& journal_file,
+        size_t threads, uint64_t seed) {
+        ostream null_log(nullptr);
+        CorruptionJournal journal;
+        unique_ptr<VideoCorruptor> corruptor(BatchRunner::createCorruptor(format));
+        corruptor->setLog(&null_log);
+        corruptor->setThreads(threads);
+        corruptor->setSeed(seed);
+        if (!journal_file.empty()) corruptor->setJournal(&journal);
+        if (!corruptor->loadFile(input)) return false;
+        corruptor->applyCorruption();
+        if (!journal_file.empty() && !journal.save(journal_file)) return false;
+        return corruptor->saveFile(output);
+    }
+
+    // self-test at a small size: the output does not depend on the thread count, the journal
+    // reverts it byte-exact and the structure survives the corruption
+    bool checkFormat(const string& format, const BenchOptions& options) {
+        fs::path dir(options.dir);
+        string input = (dir / ("vccheck_input." + format)).string();
+        string single = (dir / ("vccheck_single." + format)).string();
+        string multi = (dir / ("vccheck_multi." + format)).string();
+        string reverted = (dir / ("vccheck_reverted." + format)).string();
+        string journal_file = (dir / ("vccheck_journal_" + format + ".vcj")).string();
+        size_t threads = max<size_t>(options.threads, max(2u, thread::hardware_concurrency()));
+
+        cout << format << ": " << (options.media.size >> 20) << " MiB, threads 1 and " << threads << endl;
+        bool ok = format == "avi" ? SyntheticMedia::writeAVI(input, options.media) : SyntheticMedia::writeMP4(input, options.media);
+        if (!ok) return false;
+
+        ok = corruptOnce(format, input, single, journal_file, 1, options.media.seed) &&
+            corruptOnce(format, input, multi, "", threads, options.media.seed);
+        if (ok && !(ok = sameFile(single, multi))) cerr << "check: output differs between 1 and " << threads << " threads" << endl;
+        if (ok) {
+            CorruptionJournal journal;
+            ok = journal.load(journal_file) && journal.revert(single, reverted);
+            if (ok && !(ok = sameFile(input, reverted))) cerr << "check: reverted output differs from the input" << endl;
+        }
+        if (ok) ok = verifyLarge(format, input, single);
+        cout << "  " << (ok ? "ok" : "FAILED") << endl;
+
+        if (!options.keep) {
+            error_code ec;
+            for (const string& file : { input, single, multi, reverted, journal_file }) fs::remove(file, ec);
+        }
+        return ok;
+    }
+
+    bool benchFormat(const string& format, const BenchOptions& options) {
+        bool avi = format == "avi";
+        string input = (fs::path(options.dir) / ("vcbench_input." + format)).string();
+        string output = (fs::path(options.dir) / ("vcbench_output." + format)).string();
+
+        cout << format << ": " << (options.media.size >> 20) << " MiB, frame size " << options.media.frame_size
+            << ", audio " << options.media.audio_size << ", burst " << options.burst << endl;
+        bool generated = false;
+        double ms = bestOf(1, [&]() {
+            generated = avi ? SyntheticMedia::writeAVI(input, options.media) : SyntheticMedia::writeMP4(input, options.media);
+        });
+        if (!generated) return false;
+        uint64_t size = fs::file_size(input);
+        reportBytes("generate", size, ms);
+
+        // load
+        FileBuffer buffer;
+        bool ok = true;
+        if (options.large) {
+            // the input need not fit into memory, everything reads it through the page cache
+            ms = bestOf(options.repeat, [&]() {
+                ok = buffer.loadMapped(input);
+                touchPages(buffer);
+            });
+            if (!ok) return false;
+            reportBytes("load (mmap + touch)", size, ms);
+        }
+        else {
+            // background reads, on io_uring when the kernel allows it and on threads (before the
+            // copy below is held, both need the file in memory)
+            for (bool ring : { true, false }) {
+                AsyncFile::setRingEnabled(ring);
+                AsyncFile probe;
+                if (!probe.open(input, AsyncFile::READ)) return false;
+                string backend = probe.backendName();
+                probe.finish();
+                if (ring && backend != "io_uring") continue;
+                FileBuffer async;
+                ms = bestOf(options.repeat, [&]() { ok = async.loadAsync(input) && async.finishLoad() && ok; });
+                if (!ok) return false;
+                reportBytes("load (async, " + backend + ")", size, ms);
+            }
+            AsyncFile::setRingEnabled(true);
+            ms = bestOf(options.repeat, [&]() { ok = buffer.loadCopy(input) && ok; });
+            if (!ok) return false;
+            reportBytes("load (copy)", size, ms);
+            FileBuffer mapped;
+            ms = bestOf(options.repeat, [&]() {
+                mapped.loadMapped(input);
+                touchPages(mapped);
+            });
+            reportBytes("load (mmap + touch)", size, ms);
+        }
+        const uint8_t* data = buffer.data();
+
+        // scanners
+        SignatureScanner scanner;
+        if (avi) AVICorruptor::addSignatures(scanner);
+        else MP4Corruptor::addSignatures(scanner);
+        size_t hits = 0;
+        ms = bestOf(options.repeat, [&]() { hits = scanner.scan(data, size).size(); });
+        reportBytes(string("signature scan (") + SignatureScanner::engineName() + ")", size, ms);
+        {
+            ThreadPool pool(options.threads);
+            ms = bestOf(options.repeat, [&]() { hits = scanner.scan(pool, data, size, 0, size).size(); });
+            reportBytes(string("signature scan (") + SignatureScanner::engineName() + ", " + to_string(pool.size()) + " threads)", size, ms);
+        }
+
+        vector<size_t> frame_starts;
+        if (avi) {
+            AVIRiffParser parser;
+            ms = bestOf(options.repeat, [&]() { parser.parse(data, size); });
+            for (const auto& chunk : parser.getChunks()) frame_starts.push_back((size_t)chunk.offset);
+            reportBytes("RIFF parse", size, ms);
+        }
+        else {
+            MP4BoxParser parser;
+            ms = bestOf(options.repeat, [&]() { parser.parse(data, size); });
+            for (const auto& track : parser.getTracks()) {
+                for (const auto& sample : track.samples) frame_starts.push_back((size_t)sample.offset);
+            }
+            sort(frame_starts.begin(), frame_starts.end());
+            reportBytes("box tree parse", size, ms);
+        }
+        cout << "  (" << hits << " signature hits, " << frame_starts.size() << " frames)" << endl;
+
+        // mask construction as a whole: the corruptor's analyze
+        ostream null_log(nullptr);
+        unique_ptr<VideoCorruptor> corruptor(BatchRunner::createCorruptor(format));
+        corruptor->setLog(&null_log);
+        corruptor->setThreads(options.threads);
+        corruptor->setSeed(options.media.seed);
+        corruptor->setMemoryMapped(options.large);
+        if (!corruptor->readFile(input) || !corruptor->finishRead()) return false;
+        ms = bestOf(options.repeat, [&]() { corruptor->analyze(); });
+        reportBytes("analyze (parse + mask)", size, ms);
+
+        RangeSet ranges;
+        size_t header = avi ? AVI_FRAME_HEADER_SIZE : MP4_FRAME_HEADER_PROTECT_SIZE;
+        ms = bestOf(options.repeat, [&]() { ranges = frameHeaderRanges(frame_starts, header, size); });
+        report("mask from frame offsets", frame_starts.size() / 1e6, ms, "Mframes/s");
+
+        // positions
+        size_t draws = max<size_t>(frame_starts.size(), 1000000);
+        ms = bestOf(options.repeat, [&]() {
+            PositionSampler sampler(ranges);
+            sampler.addWindow(0, size);
+            mt19937 rng(1);
+            sampler.drawMany(rng, draws);
+        });
+        report("position sampling", draws / 1e6, ms, "Mpos/s");
+        ms = bestOf(options.repeat, [&]() {
+            PositionSampler sampler(ranges);
+            sampler.addWindow(0, size);
+            mt19937 rng(1);
+            sampler.drawSorted(rng, draws);
+        });
+        report("position sampling (sorted)", draws / 1e6, ms, "Mpos/s");
+
+        // each corruption operation over (a slice of) the file in bursts
+        vector<uint8_t> work(data, data + min<uint64_t>(size, BENCH_KERNEL_SLICE));
+        vector<uint8_t> operand(options.burst);
+        GlitchRandom(options.media.seed, 0).fillBytes(operand.data(), operand.size());
+        using namespace GlitchKernels;
+        benchKernel("bitflip", BitFlip{}, work, operand, options.burst, options.repeat);
+        benchKernel("substitute", Substitute{ 0xF0 }, work, operand, options.burst, options.repeat);
+        benchKernel("fill", Fill{ 0x80 }, work, operand, options.burst, options.repeat);
+        benchKernel("xor", Xor{ 0xFF }, work, operand, options.burst, options.repeat);
+        benchKernel("negate", Negate{}, work, operand, options.burst, options.repeat);
+        benchKernel("shift", Shift{ 3 }, work, operand, options.burst, options.repeat);
+        benchNoise(work, operand, options.burst, options.repeat);
+        benchKernel("copy", Copy{}, work, operand, options.burst, options.repeat);
+        vector<uint8_t>().swap(work);
+
+        // the whole glitch engine once (it mutates the file)
+        ms = bestOf(1, [&]() { corruptor->applyCorruption(); });
+        reportBytes("applyCorruption", size, ms);
+
+        // save
+        ms = bestOf(options.repeat, [&]() { ok = corruptor->saveFile(output) && ok; });
+        if (!ok) return false;
+        reportBytes("save", size, ms);
+
+        // corrupt once more with the output written behind the sweep
+        ms = bestOf(1, [&]() {
+            corruptor->beginSave(output);
+            corruptor->applyCorruption();
+            ok = corruptor->saveFile(output);
+        });
+        if (!ok) return false;
+        reportBytes("applyCorruption + save", size, ms);
+
+        corruptor.reset();
+        if (options.large) {
+            ms = bestOf(1, [&]() { ok = verifyLarge(format, input, output); });
+            reportBytes("verify", 2 * size, ms);
+            if (!ok) return false;
+        }
+        if (!options.keep) {
+            error_code ec;
+            fs::remove(input, ec);
+            fs::remove(output, ec);
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    options.dir = fs::temp_directory_path().string();
+    vector<string> formats;
+    bool size_set = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            options.media.size = strtoull(argv[++i], nullptr, 10) << 20;
+            size_set = true;
+        }
+        else if (arg == "--frame-size" && i + 1 < argc) {
+            options.media.frame_size = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--audio-size" && i + 1 < argc) {
+            options.media.audio_size = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--fragment" && i + 1 < argc) {
+            options.media.fragment_frames = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            options.media.seed = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--burst" && i + 1 < argc) {
+            options.burst = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--repeat" && i + 1 < argc) {
+            options.repeat = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--dir" && i + 1 < argc) {
+            options.dir = argv[++i];
+        }
+        else if (arg == "--keep") {
+            options.keep = true;
+        }
+        else if (arg == "--large") {
+            options.large = true;
+        }
+        else if (arg == "--check") {
+            options.check = true;
+        }
+        else if (arg == "avi" || arg == "mp4") {
+            formats.push_back(arg);
+        }
+        else if (arg == "all") {
+            formats = { "avi", "mp4" };
+        }
+        else {
+            cout << "usage: " << argv[0] << " [avi|mp4|all] [options]" << endl;
+            cout << "options:" << endl;
+            cout << "  --size <MiB>        size of the generated inputs (default: 64)" << endl;
+            cout << "  --frame-size <n>    mean video frame size in bytes (default: 20000)" << endl;
+            cout << "  --audio-size <n>    audio chunk after every frame, 0 = none (default: 512)" << endl;
+            cout << "  --fragment <n>      MP4: fragmented, n frames per moof/mdat (default: 0 = one mdat)" << endl;
+            cout << "  --seed <n>          generator and corruption seed (default: 1)" << endl;
+            cout << "  --burst <n>         burst length of the operation benchmarks (default: 32)" << endl;
+            cout << "  --repeat <n>        runs per stage, the fastest is reported (default: 3)" << endl;
+            cout << "  --threads <n>       threads of applyCorruption and the parallel signature scan (default: all hardware threads)" << endl;
+            cout << "  --dir <path>        where inputs and outputs are written (default: temp directory)" << endl;
+            cout << "  --keep              keep the generated files" << endl;
+            cout << "  --large             inputs larger than memory (default size 8192 MiB): mmap only, one run" << endl;
+            cout << "                      per stage, then check the output structure and glitches past 4 GiB" << endl;
+            cout << "  --check             no timings: check that the output is the same for 1 and n threads, that" << endl;
+            cout << "                      the journal reverts it and that its structure is intact (default size 4 MiB)" << endl;
+            return 1;
+        }
+    }
+    if (formats.empty()) formats = { "avi", "mp4" };
+    if (options.large) {
+        if (!size_set) options.media.size = 8192ull << 20;
+        options.repeat = 1;
+    }
+
+    if (options.check && !size_set) options.media.size = 4ull << 20;
+
+    for (const string& format : formats) {
+        if (options.check ? !checkFormat(format, options) : !benchFormat(format, options)) {
+            cerr << format << (options.check ? " check" : " benchmark") << " failed" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// BufferCorruptor.cpp
+#include "BufferCorruptor.h"
+#include "BatchRunner.h"
+
+using namespace std;
+
+BufferCorruptor::BufferCorruptor(const string& format) : corruptor(BatchRunner::createCorruptor(format)) {
+    if (!corruptor) return;
+    default_stages = corruptor->getStages();
+    corruptor->setLog(&null_log);
+}
+
+BufferCorruptor::~BufferCorruptor() {
+    // the buffers belong to the caller
+    if (corruptor) corruptor->file_data.reset();
+}
+
+void BufferCorruptor::setLog(std::ostream* stream) {
+    if (corruptor) corruptor->setLog(stream ? stream : &null_log);
+}
+
+bool BufferCorruptor::analyze(const uint8_t* data, size_t size) {
+    if (!corruptor || !data) return false;
+    source = data;
+    source_size = size;
+    // analysis only reads the buffer
+    corruptor->file_data.borrow(const_cast<uint8_t*>(data), size);
+    corruptor->source_name.clear();
+    corruptor->analysis_cached = false;
+    corruptor->metrics.reset();
+    corruptor->metrics.input = "<buffer>";
+    corruptor->metrics.file_size = size;
+    if (!corruptor->analyze()) {
+        source = nullptr;
+        source_size = 0;
+        return false;
+    }
+    return true;
+}
+
+bool BufferCorruptor::corrupt(uint8_t* data, size_t size, const Options& options) {
+    if (!corruptor || !source || !data || size != source_size) return false;
+    corruptor->file_data.borrow(data, size);
+    corruptor->setSeed(options.seed);
+    corruptor->setThreads(options.threads);
+    corruptor->setStages(options.stages.empty() ? default_stages : options.stages);
+    corruptor->applyCorruption();
+    // nothing points at the output once the call returns
+    corruptor->file_data.borrow(const_cast<uint8_t*>(source), source_size);
+    return true;
+}
+
+bool BufferCorruptor::corruptInto(uint8_t* out, size_t out_size, const Options& options) {
+    if (!source || !out || out_size < source_size) return false;
+    memcpy(out, source, source_size);
+    return corrupt(out, source_size, options);
+}
@@ -0,0 +1,68 @@
+// BufferCorruptor.h
+#ifndef BUFFERCORRUPTOR_H
+#define BUFFERCORRUPTOR_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "VideoCorruptor.h"
+
+using std::string;
+using std::vector;
+
+/**
+*  BufferCorruptor
+* @brief In-memory entry point of the library: analyze a caller-owned buffer once, corrupt it
+*  (or copies of it) as often as needed, no files and no processes involved.
+* @details analyze() keeps a pointer to the caller's bytes and never writes them. corrupt()
+*  mutates a buffer holding those bytes in place, corruptInto() copies the analyzed bytes into a
+*  caller-provided buffer first and corrupts the copy, so one analysis serves any number of
+*  seeds. The output for a seed and stage schedule equals the CLI's output for the same input,
+*  --seed and stages. Silent by default; one instance is not thread-safe, use one per thread.
+* @author AXIS5 with assistance from LLM
+*/
+class BufferCorruptor {
+public:
+    struct Options {
+        uint64_t seed = 0;
+        vector<VideoCorruptor::CorruptionStage> stages;     // empty = the format's default stages
+        size_t threads = 1;                                 // glitch threads, 0 = one per hardware thread
+    };
+
+    //"avi" or "mp4"
+    explicit BufferCorruptor(const string& format);
+    ~BufferCorruptor();
+
+    //false if the format is not supported
+    bool valid() const { return (bool)corruptor; }
+
+    //progress output, nullptr = silent
+    void setLog(std::ostream* stream);
+
+    //find the structures to protect; data must stay alive and unchanged while corruptInto is used
+    bool analyze(const uint8_t* data, size_t size);
+
+    //corrupt size bytes in place; data must hold the analyzed bytes (the analyzed buffer or a copy)
+    bool corrupt(uint8_t* data, size_t size, const Options& options);
+
+    //copy the analyzed bytes to out (out_size must be at least the analyzed size) and corrupt there
+    bool corruptInto(uint8_t* out, size_t out_size, const Options& options);
+
+    //default stages of the format
+    const vector<VideoCorruptor::CorruptionStage>& defaultStages() const { return default_stages; }
+
+    //counters of the analysis and the last corruption
+    const CorruptionMetrics& getMetrics() const { return corruptor->metrics; }
+
+private:
+    std::unique_ptr<VideoCorruptor> corruptor;
+    vector<VideoCorruptor::CorruptionStage> default_stages;
+    std::ostream null_log{ nullptr };
+    const uint8_t* source = nullptr;
+    size_t source_size = 0;
+};
+
+#endif // !BUFFERCORRUPTOR_H
@@ -0,0 +1,202 @@
+// CorruptionJournal.cpp
+#include "CorruptionJournal.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+using namespace std;
+
+namespace {
+    void putU32(ofstream& out, uint32_t v) {
+        uint8_t b[4];
+        for (int i = 0; i < 4; i++) b[i] = static_cast<uint8_t>(v >> (8 * i));
+        out.write(reinterpret_cast<const char*>(b), 4);
+    }
+
+    void putU64(ofstream& out, uint64_t v) {
+        uint8_t b[8];
+        for (int i = 0; i < 8; i++) b[i] = static_cast<uint8_t>(v >> (8 * i));
+        out.write(reinterpret_cast<const char*>(b), 8);
+    }
+
+    bool getU32(ifstream& in, uint32_t& v) {
+        uint8_t b[4];
+        if (!in.read(reinterpret_cast<char*>(b), 4)) return false;
+        v = 0;
+        for (int i = 0; i < 4; i++) v |= (uint32_t)b[i] << (8 * i);
+        return true;
+    }
+
+    bool getU64(ifstream& in, uint64_t& v) {
+        uint8_t b[8];
+        if (!in.read(reinterpret_cast<char*>(b), 8)) return false;
+        v = 0;
+        for (int i = 0; i < 8; i++) v |= (uint64_t)b[i] << (8 * i);
+        return true;
+    }
+
+    struct PatchByte {
+        uint64_t offset;
+        uint64_t seq;
+        uint8_t value;
+    };
+}
+
+void CorruptionJournal::record(uint64_t offset, const uint8_t* old_bytes, const uint8_t* new_bytes, uint32_t length) {
+    if (length == 0 || memcmp(old_bytes, new_bytes, length) == 0) return;
+    Entry e = { offset, length, pool.size() };
+    pool.insert(pool.end(), old_bytes, old_bytes + length);
+    pool.insert(pool.end(), new_bytes, new_bytes + length);
+    entries.push_back(e);
+}
+
+void CorruptionJournal::clear() {
+    entries.clear();
+    pool.clear();
+}
+
+bool CorruptionJournal::save(const string& filename) const {
+    ofstream out(filename, ios::binary);
+    if (!out) {
+        cerr << "Error creating journal file: " << filename << endl;
+        return false;
+    }
+    out.write(JOURNAL_MAGIC, 4);
+    putU64(out, source_size);
+    putU64(out, entries.size());
+    for (const Entry& e : entries) {
+        putU64(out, e.offset);
+        putU32(out, e.length);
+        out.write(reinterpret_cast<const char*>(pool.data() + e.data), 2 * (size_t)e.length);
+    }
+    out.close();
+    if (out.fail()) {
+        cerr << "Error writing journal file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+bool CorruptionJournal::load(const string& filename) {
+    clear();
+    ifstream in(filename, ios::binary | ios::ate);
+    if (!in) {
+        cerr << "Error opening journal file: " << filename << endl;
+        return false;
+    }
+    // entry lengths are checked against the bytes left before anything is allocated for them
+    uint64_t file_size = (uint64_t)max<streamoff>(0, in.tellg());
+    in.seekg(0, ios::beg);
+    char magic[4];
+    uint64_t count = 0;
+    if (!in.read(magic, 4) || memcmp(magic, JOURNAL_MAGIC, 4) != 0 ||
+        !getU64(in, source_size) || !getU64(in, count)) {
+        cerr << "Not a corruption journal: " << filename << endl;
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        Entry e;
+        if (!getU64(in, e.offset) || !getU32(in, e.length) ||
+            2 * (uint64_t)e.length > file_size - (uint64_t)in.tellg()) {
+            cerr << "Truncated journal file: " << filename << endl;
+            clear();
+            return false;
+        }
+        // apply would skip bytes past the source and offset + j could wrap: a damaged journal
+        if (e.offset > source_size || e.length > source_size - e.offset) {
+            cerr << "Journal entry outside the source (" << source_size << " bytes): " << filename << endl;
+            clear();
+            return false;
+        }
+        e.data = pool.size();
+        pool.resize(pool.size() + 2 * (size_t)e.length);
+        if (!in.read(reinterpret_cast<char*>(pool.data() + e.data), 2 * (size_t)e.length)) {
+            cerr << "Truncated journal file: " << filename << endl;
+            clear();
+            return false;
+        }
+        entries.push_back(e);
+    }
+    return true;
+}
+
+bool CorruptionJournal::replay(const string& source, const string& output) const {
+    return apply(source, output, true);
+}
+
+bool CorruptionJournal::revert(const string& corrupted, const string& output) const {
+    return apply(corrupted, output, false);
+}
+
+// Collapse the journal into one final value per offset, then stream input -> output
+// patching those offsets on the way. Forward: the last write of a byte wins.
+// Backward: the first recorded old value of a byte wins.
+bool CorruptionJournal::apply(const string& input, const string& output, bool forward) const {
+    vector<PatchByte> patch;
+    patch.reserve(mutatedBytes());
+    uint64_t seq = 0;
+    for (const Entry& e : entries) {
+        const uint8_t* src = forward ? newBytes(e) : oldBytes(e);
+        for (uint32_t j = 0; j < e.length; j++) {
+            patch.push_back({ e.offset + j, seq++, src[j] });
+        }
+    }
+    sort(patch.begin(), patch.end(), [](const PatchByte& a, const PatchByte& b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.seq < b.seq;
+    });
+    vector<PatchByte> final_patch;
+    final_patch.reserve(patch.size());
+    for (size_t i = 0; i < patch.size(); i++) {
+        bool first = final_patch.empty() || final_patch.back().offset != patch[i].offset;
+        if (first) {
+            final_patch.push_back(patch[i]);
+        }
+        else if (forward) {
+            final_patch.back() = patch[i];
+        }
+    }
+
+    ifstream in(input, ios::binary | ios::ate);
+    if (!in) {
+        cerr << "Error opening file: " << input << endl;
+        return false;
+    }
+    uint64_t input_size = (uint64_t)in.tellg();
+    if (input_size != source_size) {
+        cerr << "Size mismatch: " << input << " has " << input_size
+            << " bytes, journal expects " << source_size << endl;
+        return false;
+    }
+    in.seekg(0, ios::beg);
+    ofstream out(output, ios::binary);
+    if (!out) {
+        cerr << "Error creating output file: " << output << endl;
+        return false;
+    }
+
+    unique_ptr<char[]> block(new char[JOURNAL_STREAM_BLOCK_SIZE]);
+    uint64_t block_start = 0;
+    size_t next = 0;
+    while (block_start < input_size) {
+        size_t block_len = (size_t)min<uint64_t>(JOURNAL_STREAM_BLOCK_SIZE, input_size - block_start);
+        if (!in.read(block.get(), block_len)) {
+            cerr << "Error reading file: " << input << endl;
+            return false;
+        }
+        uint64_t block_end = block_start + block_len;
+        while (next < final_patch.size() && final_patch[next].offset < block_end) {
+            block[final_patch[next].offset - block_start] = static_cast<char>(final_patch[next].value);
+            next++;
+        }
+        out.write(block.get(), block_len);
+        if (!out) {
+            cerr << "Error writing output file: " << output << endl;
+            return false;
+        }
+        block_start = block_end;
+    }
+    out.close();
+    return !out.fail();
+}
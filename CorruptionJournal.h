@@ -0,0 +1,67 @@
+// CorruptionJournal.h
+#ifndef CORRUPTIONJOURNAL_H
+#define CORRUPTIONJOURNAL_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+using std::string;
+
+#define JOURNAL_MAGIC "VCJ1"
+// block size used when streaming a source through replay/revert
+#define JOURNAL_STREAM_BLOCK_SIZE (4u << 20)
+
+/**
+*  CorruptionJournal
+* @brief Records every mutation made by a corruptor as (offset, old bytes, new bytes).
+* @details A journal is a compact binary patch against the pristine source. It can be replayed
+*  onto the source to rebuild the corrupted file, or reverted from the corrupted file to get the
+*  source back, both as a single streaming pass.
+*
+*  File layout (little-endian):
+*    "VCJ1" | u64 source size | u64 entry count |
+*    entry: u64 offset | u32 length | old bytes[length] | new bytes[length]
+* @author AXIS5 with assistance from LLM
+*/
+class CorruptionJournal {
+public:
+    struct Entry {
+        uint64_t offset;    // first mutated byte
+        uint32_t length;    // number of bytes
+        size_t data;        // index of the old bytes in the pool, new bytes follow
+    };
+
+    //record one mutation; identical old/new data is dropped
+    void record(uint64_t offset, const uint8_t* old_bytes, const uint8_t* new_bytes, uint32_t length);
+
+    void clear();
+    size_t size() const { return entries.size(); }
+    size_t mutatedBytes() const { return pool.size() / 2; }
+    const vector<Entry>& getEntries() const { return entries; }
+    const uint8_t* oldBytes(const Entry& e) const { return pool.data() + e.data; }
+    const uint8_t* newBytes(const Entry& e) const { return pool.data() + e.data + e.length; }
+
+    void setSourceSize(uint64_t size) { source_size = size; }
+    uint64_t getSourceSize() const { return source_size; }
+
+    bool save(const string& filename) const;
+    bool load(const string& filename);
+
+    //stream source through the journal into output (pristine -> corrupted)
+    bool replay(const string& source, const string& output) const;
+
+    //stream a corrupted file back to the pristine source (corrupted -> pristine)
+    bool revert(const string& corrupted, const string& output) const;
+
+private:
+    vector<Entry> entries;
+    vector<uint8_t> pool;
+    uint64_t source_size = 0;
+
+    bool apply(const string& input, const string& output, bool forward) const;
+};
+
+#endif // !CORRUPTIONJOURNAL_H
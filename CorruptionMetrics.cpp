@@ -0,0 +1,145 @@
+// CorruptionMetrics.cpp
+#include "CorruptionMetrics.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+void CorruptionMetrics::reset() {
+    *this = CorruptionMetrics();
+}
+
+void CorruptionMetrics::beginCorruption(size_t stage_count, const vector<string>& names) {
+    stages.assign(stage_count, Stage());
+    for (auto& c : op_counts) c = 0;
+    op_names = names;
+    save_method.clear();
+    saved_bytes = 0;
+    // corruption phases of the previous run go, read/analyze stay
+    vector<Phase> kept;
+    for (const Phase& p : phases) {
+        if (p.name == "read" || p.name == "analyze") kept.push_back(p);
+    }
+    phases.swap(kept);
+}
+
+void CorruptionMetrics::addPhase(const string& name, double ms) {
+    for (Phase& p : phases) {
+        if (p.name == name) {
+            p.ms += ms;
+            return;
+        }
+    }
+    phases.push_back({ name, ms });
+}
+
+string CorruptionMetrics::quote(const string& s) {
+    ostringstream out;
+    out << '"';
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\r': out << "\\r"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if (c < 0x20) out << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+            else out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+void CorruptionMetrics::writeJSON(ostream& out, const string& indent) const {
+    string in1 = indent + "  ";
+    string in2 = in1 + "  ";
+    uint64_t requested = 0, applied = 0, mutated = 0;
+    for (const Stage& s : stages) {
+        requested += s.requested;
+        applied += s.applied;
+        mutated += s.mutated_bytes;
+    }
+    auto ms = [](double v) {
+        ostringstream s;
+        s << fixed << setprecision(3) << v;
+        return s.str();
+    };
+
+    out << "{\n";
+    out << in1 << "\"format\": " << quote(format) << ",\n";
+    out << in1 << "\"input\": " << quote(input) << ",\n";
+    out << in1 << "\"file_size\": " << file_size << ",\n";
+    out << in1 << "\"seed\": " << seed << ",\n";
+    out << in1 << "\"analysis_cached\": " << (analysis_cached ? "true" : "false") << ",\n";
+
+    out << in1 << "\"scans\": [";
+    for (size_t i = 0; i < scans.size(); i++) {
+        const Scan& s = scans[i];
+        out << (i ? ",\n" : "\n") << in2 << "{ \"name\": " << quote(s.name) << ", \"bytes\": " << s.bytes
+            << ", \"hits\": " << s.hits << ", \"ms\": " << ms(s.ms) << " }";
+    }
+    out << (scans.empty() ? "],\n" : "\n" + in1 + "],\n");
+
+    out << in1 << "\"protected_bytes\": " << protected_bytes << ",\n";
+    out << in1 << "\"protected_ratio\": " << fixed << setprecision(6)
+        << (file_size ? (double)protected_bytes / (double)file_size : 0.0) << defaultfloat << ",\n";
+    out << in1 << "\"frames\": " << frames << ",\n";
+    out << in1 << "\"audio_frames\": " << audio_frames << ",\n";
+
+    out << in1 << "\"stages\": [";
+    for (size_t i = 0; i < stages.size(); i++) {
+        const Stage& s = stages[i];
+        out << (i ? ",\n" : "\n") << in2 << "{ \"requested\": " << s.requested << ", \"drawn\": " << s.drawn
+            << ", \"applied\": " << s.applied << ", \"rejected\": " << (s.drawn - s.applied)
+            << ", \"mutated_bytes\": " << s.mutated_bytes << " }";
+    }
+    out << (stages.empty() ? "],\n" : "\n" + in1 + "],\n");
+    out << in1 << "\"glitches_requested\": " << requested << ",\n";
+    out << in1 << "\"glitches_applied\": " << applied << ",\n";
+    out << in1 << "\"mutated_bytes\": " << mutated << ",\n";
+
+    out << in1 << "\"operations\": {";
+    bool first = true;
+    for (size_t i = 0; i < GLITCH_MAX_OPS; i++) {
+        if (!op_counts[i] && i >= op_names.size()) continue;
+        string name = i < op_names.size() ? op_names[i] : "op" + to_string(i);
+        out << (first ? "\n" : ",\n") << in2 << quote(name) << ": " << op_counts[i];
+        first = false;
+    }
+    out << (first ? "},\n" : "\n" + in1 + "},\n");
+
+    out << in1 << "\"save_method\": " << quote(save_method) << ",\n";
+    out << in1 << "\"saved_bytes\": " << saved_bytes << ",\n";
+
+    out << in1 << "\"phases_ms\": {";
+    for (size_t i = 0; i < phases.size(); i++) {
+        out << (i ? ",\n" : "\n") << in2 << quote(phases[i].name) << ": " << ms(phases[i].ms);
+    }
+    out << (phases.empty() ? "}\n" : "\n" + in1 + "}\n");
+    out << indent << "}";
+}
+
+bool CorruptionMetrics::save(const string& filename) const {
+    if (filename == "-") {
+        writeJSON(cout);
+        cout << endl;
+        return true;
+    }
+    ofstream out(filename, ios::trunc);
+    if (!out) {
+        cerr << "Error creating metrics file: " << filename << endl;
+        return false;
+    }
+    writeJSON(out);
+    out << "\n";
+    out.close();
+    if (out.fail()) {
+        cerr << "Error writing metrics file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
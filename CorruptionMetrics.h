@@ -0,0 +1,91 @@
+// CorruptionMetrics.h
+#ifndef CORRUPTIONMETRICS_H
+#define CORRUPTIONMETRICS_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+using std::string;
+
+// operation ids planGlitch can pick (0..GLITCH_MAX_OPS-1)
+#define GLITCH_MAX_OPS 8
+
+/**
+*  CorruptionMetrics
+* @brief Counters and timings of one corruption run, written as a JSON report.
+* @details Filled by the corruptors as they go: every scanner/parser with the bytes it covered,
+*  the protected byte count and frames found by the analysis, per stage the glitches requested,
+*  the positions drawn and the glitches applied (a position is rejected when its burst has no
+*  byte left to touch), the picks of each operation and the duration of every phase.
+*  Counting is a few additions per glitch, nothing is printed while the run is hot.
+* @author AXIS5 with assistance from LLM
+*/
+class CorruptionMetrics {
+public:
+    struct Scan {
+        string name;
+        uint64_t bytes;
+        uint64_t hits;
+        double ms;
+    };
+
+    struct Stage {
+        uint64_t requested = 0;
+        uint64_t drawn = 0;
+        uint64_t applied = 0;
+        uint64_t mutated_bytes = 0;
+    };
+
+    struct Phase {
+        string name;
+        double ms;
+    };
+
+    string format;
+    string input;
+    uint64_t file_size = 0;
+    uint64_t seed = 0;
+    bool analysis_cached = false;
+    vector<Scan> scans;
+    uint64_t protected_bytes = 0;
+    uint64_t frames = 0;
+    uint64_t audio_frames = 0;
+    vector<Stage> stages;
+    uint64_t op_counts[GLITCH_MAX_OPS] = {};
+    vector<string> op_names;        // op id -> name, given by the corruptor
+    vector<Phase> phases;
+    string save_method;             // FileBuffer::saveMethod of the last save, empty before one
+    uint64_t saved_bytes = 0;       // bytes it wrote from memory
+
+    //forget everything, at the start of a new input
+    void reset();
+
+    //forget the counters of the previous corruption, keep load and analysis
+    void beginCorruption(size_t stage_count, const vector<string>& names);
+
+    void addScan(const string& name, uint64_t bytes, uint64_t hits, double ms) { scans.push_back({ name, bytes, hits, ms }); }
+
+    //add ms to a phase, a repeated phase accumulates
+    void addPhase(const string& name, double ms);
+
+    //milliseconds since start
+    static double since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //one JSON object, indent is prepended to every line after the first
+    void writeJSON(std::ostream& out, const string& indent = "") const;
+
+    //write the report to a file, "-" = stdout
+    bool save(const string& filename) const;
+
+    //JSON string literal
+    static string quote(const string& s);
+};
+
+#endif // !CORRUPTIONMETRICS_H
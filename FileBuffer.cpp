@@ -0,0 +1,485 @@
+// FileBuffer.cpp
+#include "FileBuffer.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <new>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+#if !defined(_WIN32) && !defined(_WIN64)
+    int64_t mtimeOf(const struct stat& st) {
+#if defined(__linux__)
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+        return (int64_t)st.st_mtime;
+#endif
+    }
+#endif
+
+#if defined(__linux__)
+    // filesystems on which copy_file_range moves every page through the kernel: no faster than
+    // writing the buffer, which a streamed save does behind the corruption
+    bool copiesPages(int fd) {
+        struct statfs fs;
+        if (fstatfs(fd, &fs) != 0) return true;
+        switch ((unsigned long)fs.f_type) {
+        case 0xEF53:        // ext2/3/4
+        case 0x01021994:    // tmpfs
+            return true;
+        }
+        return false;
+    }
+
+    // copy [0, size) of src to dst inside the kernel (a reflink on filesystems that share
+    // blocks, a server-side copy on network filesystems); false if it cannot
+    bool copyRange(int src, int dst, uint64_t size) {
+#ifdef __NR_copy_file_range
+        loff_t in = 0, out = 0;
+        while ((uint64_t)in < size) {
+            size_t want = (size_t)min<uint64_t>(size - (uint64_t)in, 1u << 30);
+            long n = syscall(__NR_copy_file_range, src, &in, dst, &out, want, 0u);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+        }
+        return true;
+#else
+        (void)src; (void)dst; (void)size;
+        return false;
+#endif
+    }
+#endif
+}
+
+FileBuffer::~FileBuffer() {
+    reset();
+}
+
+FileBuffer::FileBuffer(FileBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+FileBuffer& FileBuffer::operator=(FileBuffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        bytes = other.bytes;
+        length = other.length;
+        mapped = other.mapped;
+        owned = std::move(other.owned);
+#if defined(_WIN32) || defined(_WIN64)
+        map_handle = other.map_handle;
+        other.map_handle = nullptr;
+#else
+        source_dev = other.source_dev;
+        source_ino = other.source_ino;
+        source_size = other.source_size;
+        source_mtime = other.source_mtime;
+#endif
+        source_path = std::move(other.source_path);
+        tracking = other.tracking;
+        dirty = std::move(other.dirty);
+        // the transfers keep their buffer, it does not move with the object
+        loader = std::move(other.loader);
+        saver = std::move(other.saver);
+        save_name = std::move(other.save_name);
+        save_path = std::move(other.save_path);
+        save_queued = other.save_queued;
+        clone_fd = other.clone_fd;
+        save_method = other.save_method;
+        saved_bytes = other.saved_bytes;
+        other.clone_fd = -1;
+        other.tracking = false;
+        other.bytes = nullptr;
+        other.length = 0;
+        other.mapped = false;
+    }
+    return *this;
+}
+
+void FileBuffer::reset() {
+    // nothing may still be transferring into or out of the storage
+    abortSave();
+    if (loader) loader->finish();
+    loader.reset();
+    if (mapped && bytes) {
+#if defined(_WIN32) || defined(_WIN64)
+        UnmapViewOfFile(bytes);
+        if (map_handle) CloseHandle(map_handle);
+        map_handle = nullptr;
+#else
+        munmap(bytes, length);
+#endif
+    }
+    owned.reset();
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    source_path.clear();
+    tracking = false;
+    dirty.clear();
+}
+
+void FileBuffer::setSource(const string& filename) {
+    source_path = filename;
+#if !defined(_WIN32) && !defined(_WIN64)
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        source_path.clear();
+        return;
+    }
+    source_dev = (uint64_t)st.st_dev;
+    source_ino = (uint64_t)st.st_ino;
+    source_size = (uint64_t)st.st_size;
+    source_mtime = mtimeOf(st);
+#endif
+}
+
+bool FileBuffer::fitsInMemory(uint64_t size, const string& filename) {
+    // a 32-bit build cannot address more than SIZE_MAX bytes, refuse instead of wrapping around
+    if (size > (uint64_t)SIZE_MAX) {
+        cerr << "File too large for this build (" << size << " bytes): " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileBuffer::loadCopy(const string& filename) {
+    reset();
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+    streamsize size = file.tellg();
+    if (size < 0) {
+        cerr << "Error reading file size: " << filename << endl;
+        return false;
+    }
+    file.seekg(0, ios::beg);
+    if (!fitsInMemory((uint64_t)size, filename)) return false;
+
+    // plain new[] does not zero-fill, unlike vector::resize
+    owned.reset(new (nothrow) uint8_t[size > 0 ? (size_t)size : 1]);
+    if (!owned) {
+        cerr << "Not enough memory to load " << filename << " (" << size << " bytes), try --mmap" << endl;
+        return false;
+    }
+    // read in blocks, single multi-GB reads are not portable
+    uint64_t done = 0;
+    while (done < (uint64_t)size) {
+        size_t block = (size_t)min<uint64_t>(FILEBUFFER_READ_BLOCK_SIZE, (uint64_t)size - done);
+        if (!file.read(reinterpret_cast<char*>(owned.get() + done), (streamsize)block)) {
+            cerr << "Error reading file: " << filename << endl;
+            owned.reset();
+            return false;
+        }
+        done += block;
+    }
+    bytes = owned.get();
+    length = (size_t)size;
+    setSource(filename);
+    return true;
+}
+
+bool FileBuffer::loadAsync(const string& filename) {
+    reset();
+    std::unique_ptr<AsyncFile> reader(new AsyncFile());
+    if (!reader->open(filename, AsyncFile::READ)) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+    uint64_t size = reader->fileSize();
+    if (!fitsInMemory(size, filename)) return false;
+    owned.reset(new (nothrow) uint8_t[size > 0 ? (size_t)size : 1]);
+    if (!owned) {
+        cerr << "Not enough memory to load " << filename << " (" << size << " bytes), try --mmap" << endl;
+        return false;
+    }
+    reader->transfer(0, owned.get(), size);
+    bytes = owned.get();
+    length = (size_t)size;
+    loader = std::move(reader);
+    setSource(filename);
+    return true;
+}
+
+bool FileBuffer::finishLoad() {
+    if (!loader) return true;
+    bool ok = loader->finish();
+    if (!ok) {
+        cerr << "Error reading file: " << loader->fileName() << " (" << loader->errorText() << ")" << endl;
+        loader.reset();
+        reset();
+        return false;
+    }
+    loader.reset();
+    return true;
+}
+
+bool FileBuffer::loadMapped(const string& filename) {
+    reset();
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return loadCopy(filename);
+    }
+    if (!fitsInMemory((uint64_t)file_size.QuadPart, filename)) {
+        CloseHandle(file);
+        return false;
+    }
+    // PAGE_WRITECOPY + FILE_MAP_COPY: writes go to private pages, the file stays untouched
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        return loadCopy(filename);
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        return loadCopy(filename);
+    }
+    map_handle = mapping;
+    bytes = static_cast<uint8_t*>(view);
+    length = (size_t)file_size.QuadPart;
+    mapped = true;
+    setSource(filename);
+    return true;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return loadCopy(filename);
+    }
+    if (!fitsInMemory((uint64_t)st.st_size, filename)) {
+        close(fd);
+        return false;
+    }
+    // MAP_PRIVATE: copy-on-write, only written pages become anonymous memory.
+    // MAP_NORESERVE: don't charge the whole file against the commit limit, a writable private
+    // mapping larger than RAM + swap is refused otherwise
+#ifdef MAP_NORESERVE
+    int map_flags = MAP_PRIVATE | MAP_NORESERVE;
+#else
+    int map_flags = MAP_PRIVATE;
+#endif
+    void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, map_flags, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return loadCopy(filename);
+    }
+    bytes = static_cast<uint8_t*>(addr);
+    length = (size_t)st.st_size;
+    mapped = true;
+    source_path = filename;
+    source_dev = (uint64_t)st.st_dev;
+    source_ino = (uint64_t)st.st_ino;
+    source_size = (uint64_t)st.st_size;
+    source_mtime = mtimeOf(st);
+    return true;
+#endif
+}
+
+string FileBuffer::savePath(const string& filename) const {
+#if !defined(_WIN32) && !defined(_WIN64)
+    // overwriting the mapped source in place would truncate the pages we still read from,
+    // so write a sibling file and rename it over the source instead
+    struct stat st;
+    if (mapped && stat(filename.c_str(), &st) == 0 &&
+        (uint64_t)st.st_dev == source_dev && (uint64_t)st.st_ino == source_ino) {
+        return filename + ".part";
+    }
+#endif
+    return filename;
+}
+
+bool FileBuffer::save(const string& filename) {
+    bool armed = saver || clone_fd >= 0;
+    if (armed && save_name != filename) {
+        abortSave();
+        armed = false;
+    }
+    if (!armed && !beginSave(filename)) {
+        cerr << "Error creating output file: " << savePath(filename) << endl;
+        return false;
+    }
+    return finishSave();
+}
+
+bool FileBuffer::beginSave(const string& filename) {
+    abortSave();
+    // the output may be the file still being read
+    if (loading() && !finishLoad()) return false;
+    save_name = filename;
+    save_path = savePath(filename);
+    save_queued = 0;
+    saved_bytes = 0;
+    if (cloneSource()) return true;
+    save_method = "write";
+    saver.reset(new AsyncFile());
+    if (!saver->open(save_path, AsyncFile::WRITE)) {
+        saver.reset();
+        return false;
+    }
+    return true;
+}
+
+bool FileBuffer::cloneSource() {
+#if defined(__linux__)
+    if (!tracking) return false;
+    int src = open(source_path.c_str(), O_RDONLY);
+    if (src < 0) return false;
+    // the clone is only right while the file still holds the bytes loaded from it, and a file
+    // saved onto itself (in place, not mapped) has nothing left to clone from
+    struct stat st, out_st;
+    bool unchanged = fstat(src, &st) == 0 && (uint64_t)st.st_dev == source_dev &&
+        (uint64_t)st.st_ino == source_ino && (uint64_t)st.st_size == source_size &&
+        mtimeOf(st) == source_mtime && source_size == (uint64_t)length;
+    bool onto_source = stat(save_path.c_str(), &out_st) == 0 &&
+        out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino;
+    if (!unchanged || onto_source) {
+        close(src);
+        return false;
+    }
+    bool created = true;
+    int dst = open(save_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (dst < 0 && errno == EEXIST) {
+        created = false;
+        dst = open(save_path.c_str(), O_WRONLY | O_TRUNC);
+    }
+    if (dst < 0) {
+        close(src);
+        return false;
+    }
+    // FICLONE shares every block (btrfs, XFS, bcachefs); copy_file_range lets the filesystem
+    // share or copy them itself (ZFS block cloning, NFS/SMB server-side copy)
+    const char* method = nullptr;
+    if (ioctl(dst, FICLONE, src) == 0) method = "reflink";
+    else if (!copiesPages(dst) && copyRange(src, dst, source_size)) method = "copy_file_range";
+    close(src);
+    if (!method) {
+        close(dst);
+        // ext4 flushes a file on close once it was truncated and rewritten: leave no file behind
+        // for the streamed save to truncate again
+        if (created) remove(save_path.c_str());
+        return false;
+    }
+    clone_fd = dst;
+    save_method = method;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FileBuffer::patchClone() {
+#if defined(__linux__)
+    dirty.normalize();
+    bool ok = true;
+    size_t i = 0;
+    while (ok && i < dirty.size()) {
+        size_t begin = dirty[i].begin;
+        size_t end = dirty[i].end;
+        // neighbours closer than FILEBUFFER_PATCH_GAP go out in one write with the bytes between
+        while (++i < dirty.size() && dirty[i].begin - end < FILEBUFFER_PATCH_GAP) end = dirty[i].end;
+        end = min(end, length);
+        while (ok && begin < end) {
+            ssize_t n = pwrite(clone_fd, bytes + begin, min<size_t>(end - begin, 1u << 30), (off_t)begin);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = false;
+            else {
+                begin += (size_t)n;
+                saved_bytes += (uint64_t)n;
+            }
+        }
+    }
+    if (!ok) cerr << "Error writing output file: " << save_path << " (" << strerror(errno) << ")" << endl;
+    if (close(clone_fd) != 0 && ok) {
+        cerr << "Error writing output file: " << save_path << " (" << strerror(errno) << ")" << endl;
+        ok = false;
+    }
+    clone_fd = -1;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+void FileBuffer::saveUpTo(size_t end) {
+    if (!saver) return;
+    end = min(end, length);
+    if (end <= save_queued) return;
+    saver->transfer(save_queued, bytes + save_queued, end - save_queued);
+    save_queued = end;
+}
+
+bool FileBuffer::finishSave() {
+    bool ok;
+    if (clone_fd >= 0) {
+        ok = patchClone();
+    }
+    else {
+        if (!saver) return false;
+        saveUpTo(length);
+        ok = saver->finish();
+        if (!ok) cerr << "Error writing output file: " << save_path << " (" << saver->errorText() << ")" << endl;
+        saved_bytes = save_queued;
+        saver.reset();
+    }
+    if (save_path != save_name) {
+        if (ok && rename(save_path.c_str(), save_name.c_str()) != 0) {
+            cerr << "Error replacing output file: " << save_name << endl;
+            ok = false;
+        }
+        if (!ok) remove(save_path.c_str());
+    }
+    return ok;
+}
+
+void FileBuffer::abortSave() {
+#if defined(__linux__)
+    if (clone_fd >= 0) {
+        close(clone_fd);
+        clone_fd = -1;
+        remove(save_path.c_str());
+    }
+#endif
+    if (!saver) return;
+    saver->finish();
+    saver.reset();
+    remove(save_path.c_str());
+}
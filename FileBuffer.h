@@ -0,0 +1,169 @@
+// FileBuffer.h
+#ifndef FILEBUFFER_H
+#define FILEBUFFER_H
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "AsyncFile.h"
+#include "RangeSet.h"
+
+using std::string;
+
+// read block size of the blocking loadCopy
+#define FILEBUFFER_READ_BLOCK_SIZE (64u << 20)
+// dirty ranges closer than this are patched with one write, the gap holds source bytes anyway
+#define FILEBUFFER_PATCH_GAP (64u << 10)
+
+/**
+*  FileBuffer
+* @brief Byte storage for the file being corrupted.
+* @details The bytes either live in an owned heap block (read from disk in one go, no zero-fill)
+*  or in a private copy-on-write mapping of the input file. In mapped mode only the pages that
+*  the corruption actually writes to get copied into anonymous memory; everything else stays
+*  shared with the page cache.
+*  A buffer whose writes are tracked (trackWrites/markDirty) is saved as a clone of the file it
+*  was loaded from, a reflink where the filesystem shares blocks, an in-kernel copy otherwise,
+*  with only the dirty ranges written on top.
+* @author AXIS5 with assistance from LLM
+*/
+class FileBuffer {
+public:
+    FileBuffer() = default;
+    ~FileBuffer();
+
+    FileBuffer(const FileBuffer&) = delete;
+    FileBuffer& operator=(const FileBuffer&) = delete;
+    FileBuffer(FileBuffer&& other) noexcept;
+    FileBuffer& operator=(FileBuffer&& other) noexcept;
+
+    //read the whole file into an owned buffer
+    bool loadCopy(const string& filename);
+
+    //map the file copy-on-write (falls back to loadCopy if mapping is not possible)
+    bool loadMapped(const string& filename);
+
+    //allocate the owned buffer and start reading the file into it in the background;
+    //size() is final at once, only the bytes below loaded() may be read until finishLoad
+    bool loadAsync(const string& filename);
+
+    //bytes at the front that hold the file already (size() unless a loadAsync is running)
+    size_t loaded() const { return loader ? (size_t)loader->done() : length; }
+
+    //block until loaded() reaches end or the read failed; returns loaded()
+    size_t waitLoaded(size_t end) { return loader ? (size_t)loader->waitFor(end) : length; }
+
+    //wait for the rest of a loadAsync; false if the read failed (the buffer is released then)
+    bool finishLoad();
+
+    bool loading() const { return (bool)loader; }
+
+    //use memory owned by the caller (released by reset, never freed here)
+    void borrow(uint8_t* data, size_t size) {
+        reset();
+        bytes = data;
+        length = size;
+    }
+
+    //write the whole buffer to disk (completes a beginSave of the same file)
+    bool save(const string& filename);
+
+    //open filename for a save that goes out in pieces: saveUpTo queues the front of the buffer,
+    //which must not change afterwards, save/finishSave write the rest; false if the file cannot
+    //be created (save reports it). A tracked buffer is cloned here and patched by finishSave
+    bool beginSave(const string& filename);
+
+    //queue the bytes below end for writing
+    void saveUpTo(size_t end);
+
+    //queue the rest of the buffer and wait until everything is on disk
+    bool finishSave();
+
+    //stop a beginSave, the partial output is removed
+    void abortSave();
+
+    //a save is being written behind the caller, saveUpTo has an effect
+    bool saving() const { return (bool)saver; }
+
+    //from now on every write to the buffer is reported through markDirty, so a save may clone
+    //the loaded file and write only the dirty ranges (reset or a new load ends the tracking)
+    void trackWrites() { tracking = !source_path.empty(); }
+
+    //[begin, end) may differ from the loaded file
+    void markDirty(size_t begin, size_t end) {
+        if (tracking) dirty.add(begin, end);
+    }
+
+    //the dirty ranges, to be handed back by setDirtyRanges once the buffer was restored
+    const RangeSet& dirtyRanges() const { return dirty; }
+    void setDirtyRanges(const RangeSet& ranges) { dirty = ranges; }
+
+    //how the last save produced its file: "reflink", "copy_file_range" or "write"
+    const char* saveMethod() const { return save_method; }
+
+    //bytes the last save wrote from the buffer
+    uint64_t savedBytes() const { return saved_bytes; }
+
+    //release the storage
+    void reset();
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    bool isMapped() const { return mapped; }
+
+    uint8_t& operator[](size_t i) { return bytes[i]; }
+    const uint8_t& operator[](size_t i) const { return bytes[i]; }
+
+    uint8_t* begin() { return bytes; }
+    uint8_t* end() { return bytes + length; }
+    const uint8_t* begin() const { return bytes; }
+    const uint8_t* end() const { return bytes + length; }
+
+private:
+    //false (with a message) if size bytes cannot be addressed by this build
+    static bool fitsInMemory(uint64_t size, const string& filename);
+
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::unique_ptr<uint8_t[]> owned;
+#if defined(_WIN32) || defined(_WIN64)
+    void* map_handle = nullptr;
+#else
+    // identity of the loaded file: a mapped source must not be truncated underneath the
+    // mapping, a cloned save needs the file unchanged since the load
+    uint64_t source_dev = 0;
+    uint64_t source_ino = 0;
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+#endif
+    string source_path;     // file loaded, empty for borrowed memory
+    bool tracking = false;
+    RangeSet dirty;
+    // background read of loadAsync, background write of beginSave
+    std::unique_ptr<AsyncFile> loader;
+    std::unique_ptr<AsyncFile> saver;
+    string save_name;       // file asked for
+    string save_path;       // file being written, a sibling when save_name is the mapped source
+    size_t save_queued = 0;
+    int clone_fd = -1;      // output of a cloned save, patched by finishSave
+    const char* save_method = "write";
+    uint64_t saved_bytes = 0;
+
+    //path to write filename through, see save
+    string savePath(const string& filename) const;
+
+    //remember filename as the source of the bytes just loaded
+    void setSource(const string& filename);
+
+    //create save_path as a copy of the unchanged source; false if the bytes have to be written
+    bool cloneSource();
+
+    //write the dirty ranges into the clone and close it
+    bool patchClone();
+};
+
+#endif // !FILEBUFFER_H
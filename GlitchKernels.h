@@ -0,0 +1,128 @@
+// GlitchKernels.h
+#ifndef GLITCHKERNELS_H
+#define GLITCHKERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// bytes per full-width kernel step (one SSE register)
+#define GLITCH_KERNEL_WIDTH 16
+
+/**
+*  GlitchKernels
+* @brief Branch-free burst kernels for the corruption operations.
+* @details Every kernel is a functor whose step<W>() handles W bytes with a compile-time count and
+*  no data-dependent branches, so each step compiles to straight vector code. runKernel walks a
+*  burst in GLITCH_KERNEL_WIDTH steps and finishes with one step specialized for the remaining
+*  1..15 bytes, so every burst width up to 16 gets its own unrolled instance.
+*  Bursts are clipped at the first protected byte while planning, which means a kernel never sees
+*  a protected byte and needs no per-byte mask.
+*  `o` is the glitch operand prepared by planGlitch (random bytes or copy source).
+* @author AXIS5 with assistance from LLM
+*/
+namespace GlitchKernels {
+
+    // p ^= 1 << (o & 7)
+    struct BitFlip {
+        template<size_t W> void step(uint8_t* p, const uint8_t* o, size_t) const {
+            for (size_t j = 0; j < W; j++) p[j] ^= uint8_t(1u << (o[j] & 7));
+        }
+    };
+
+    // keep the bits of keep_mask, take the rest from o
+    struct Substitute {
+        uint8_t keep_mask;
+        template<size_t W> void step(uint8_t* p, const uint8_t* o, size_t) const {
+            for (size_t j = 0; j < W; j++) p[j] = uint8_t((p[j] & keep_mask) | (o[j] & ~keep_mask));
+        }
+    };
+
+    // constant fill: zero, gray, lag (value of the first burst byte)
+    struct Fill {
+        uint8_t value;
+        template<size_t W> void step(uint8_t* p, const uint8_t*, size_t) const {
+            memset(p, value, W);
+        }
+    };
+
+    // p ^= x
+    struct Xor {
+        uint8_t value;
+        template<size_t W> void step(uint8_t* p, const uint8_t*, size_t) const {
+            for (size_t j = 0; j < W; j++) p[j] ^= value;
+        }
+    };
+
+    // two's complement, ~p + 1
+    struct Negate {
+        template<size_t W> void step(uint8_t* p, const uint8_t*, size_t) const {
+            for (size_t j = 0; j < W; j++) p[j] = uint8_t(0 - p[j]);
+        }
+    };
+
+    // shift left when o is odd, right when even
+    struct Shift {
+        int amount;
+        template<size_t W> void step(uint8_t* p, const uint8_t* o, size_t) const {
+            for (size_t j = 0; j < W; j++) {
+                uint8_t left = uint8_t(p[j] << amount);
+                uint8_t right = uint8_t(p[j] >> amount);
+                uint8_t sel = uint8_t(0 - (o[j] & 1));
+                p[j] = uint8_t((left & sel) | (right & ~sel));
+            }
+        }
+    };
+
+    // even file offsets: p ^= o, odd file offsets: p = o
+    struct Noise {
+        size_t pos;     // file offset of the first burst byte
+        template<size_t W> void step(uint8_t* p, const uint8_t* o, size_t j0) const {
+            for (size_t j = 0; j < W; j++) {
+                uint8_t even = uint8_t(((pos + j0 + j) & 1) - 1);
+                p[j] = uint8_t((p[j] & even) ^ o[j]);
+            }
+        }
+    };
+
+    // p = o
+    struct Copy {
+        template<size_t W> void step(uint8_t* p, const uint8_t* o, size_t) const {
+            memcpy(p, o, W);
+        }
+    };
+
+    template<class Kernel>
+    inline void runTail(const Kernel& k, uint8_t* p, const uint8_t* o, size_t j0, size_t n) {
+        switch (n) {
+        case 1: k.template step<1>(p, o, j0); break;
+        case 2: k.template step<2>(p, o, j0); break;
+        case 3: k.template step<3>(p, o, j0); break;
+        case 4: k.template step<4>(p, o, j0); break;
+        case 5: k.template step<5>(p, o, j0); break;
+        case 6: k.template step<6>(p, o, j0); break;
+        case 7: k.template step<7>(p, o, j0); break;
+        case 8: k.template step<8>(p, o, j0); break;
+        case 9: k.template step<9>(p, o, j0); break;
+        case 10: k.template step<10>(p, o, j0); break;
+        case 11: k.template step<11>(p, o, j0); break;
+        case 12: k.template step<12>(p, o, j0); break;
+        case 13: k.template step<13>(p, o, j0); break;
+        case 14: k.template step<14>(p, o, j0); break;
+        case 15: k.template step<15>(p, o, j0); break;
+        default: break;
+        }
+    }
+
+    //apply kernel k to the len bytes at p
+    template<class Kernel>
+    inline void runKernel(const Kernel& k, uint8_t* p, const uint8_t* o, size_t len) {
+        size_t j = 0;
+        for (; j + GLITCH_KERNEL_WIDTH <= len; j += GLITCH_KERNEL_WIDTH) {
+            k.template step<GLITCH_KERNEL_WIDTH>(p + j, o + j, j);
+        }
+        runTail(k, p + j, o + j, j, len - j);
+    }
+}
+
+#endif // !GLITCHKERNELS_H
@@ -0,0 +1,91 @@
+// GlitchRandom.h
+#ifndef GLITCHRANDOM_H
+#define GLITCHRANDOM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Weyl increment of the counter (2^64 / golden ratio)
+#define GLITCH_RANDOM_GOLDEN 0x9E3779B97F4A7C15ull
+
+/**
+*  GlitchRandom
+* @brief Counter-based random stream, one per glitch.
+* @details The state is a plain 64-bit counter and every output is a SplitMix64 hash of it, so
+*  the stream of glitch n is fully determined by (seed, n). Glitches can therefore be planned and
+*  applied on any thread in any order and a seed always gives the same bytes.
+*  The fill functions hash a whole block of counters at once: the iterations are independent,
+*  so the compiler vectorizes them, and one hash yields eight bytes or two bounded values.
+* @author AXIS5 with assistance from LLM
+*/
+class GlitchRandom {
+public:
+    //independent stream number `stream` of `seed`
+    GlitchRandom(uint64_t seed, uint64_t stream) : state(mix(seed ^ mix(stream * GLITCH_RANDOM_GOLDEN + 1))) {}
+
+    //continue a stream from a saved state
+    explicit GlitchRandom(uint64_t saved_state) : state(saved_state) {}
+
+    uint64_t getState() const { return state; }
+
+    uint64_t next() {
+        state += GLITCH_RANDOM_GOLDEN;
+        return mix(state);
+    }
+
+    //uniform value in [0, n), n > 0
+    uint32_t below(uint32_t n) {
+        return (uint32_t)(((next() >> 32) * n) >> 32);
+    }
+
+    //uniform value in [lo, hi]
+    int between(int lo, int hi) {
+        return lo + (int)below(uint32_t(hi - lo + 1));
+    }
+
+    uint8_t byte() { return (uint8_t)(next() >> 56); }
+
+    //n random bytes, eight per hash (stored little-endian, same on every platform)
+    void fillBytes(uint8_t* out, size_t n) {
+        uint64_t base = state;
+        size_t words = (n + 7) / 8;
+        size_t full = n / 8;
+        for (size_t i = 0; i < full; i++) {
+            uint64_t v = mix(base + (i + 1) * GLITCH_RANDOM_GOLDEN);
+            for (int k = 0; k < 8; k++) out[8 * i + k] = (uint8_t)(v >> (8 * k));
+        }
+        if (full < words) {
+            uint64_t v = mix(base + words * GLITCH_RANDOM_GOLDEN);
+            for (size_t k = 0; k < n - 8 * full; k++) out[8 * full + k] = (uint8_t)(v >> (8 * k));
+        }
+        state = base + words * GLITCH_RANDOM_GOLDEN;
+    }
+
+    //n values uniform in [0, bound), two per hash
+    void fillBelow(uint32_t* out, size_t n, uint32_t bound) {
+        uint64_t base = state;
+        size_t words = (n + 1) / 2;
+        for (size_t i = 0; i < n / 2; i++) {
+            uint64_t v = mix(base + (i + 1) * GLITCH_RANDOM_GOLDEN);
+            out[2 * i] = (uint32_t)(((v & 0xFFFFFFFFu) * bound) >> 32);
+            out[2 * i + 1] = (uint32_t)(((v >> 32) * bound) >> 32);
+        }
+        if (n & 1) {
+            uint64_t v = mix(base + words * GLITCH_RANDOM_GOLDEN);
+            out[n - 1] = (uint32_t)(((v & 0xFFFFFFFFu) * bound) >> 32);
+        }
+        state = base + words * GLITCH_RANDOM_GOLDEN;
+    }
+
+    //SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state;
+};
+
+#endif // !GLITCHRANDOM_H
@@ -0,0 +1,414 @@
+// MP4BoxParser.cpp
+#include "MP4BoxParser.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    bool isPrintableType(uint32_t type) {
+        for (int i = 0; i < 4; i++) {
+            uint8_t c = uint8_t(type >> (8 * i));
+            if (c < 0x20 || c > 0x7E) return false;
+        }
+        return true;
+    }
+
+    struct StscEntry {
+        uint32_t first_chunk;
+        uint32_t samples_per_chunk;
+    };
+}
+
+bool MP4BoxParser::readBoxHeader(const uint8_t* data, uint64_t offset, uint64_t limit, Box& box) {
+    if (offset + 8 > limit) return false;
+    uint32_t size32 = readU32(data + offset);
+    box.offset = offset;
+    box.type = readU32(data + offset + 4);
+    if (!isPrintableType(box.type)) return false;
+    if (size32 == 1) {
+        // 64-bit largesize follows the type
+        if (offset + 16 > limit) return false;
+        box.size = readU64(data + offset + 8);
+        box.header_size = 16;
+    }
+    else if (size32 == 0) {
+        // box extends to the end of its container
+        box.size = limit - offset;
+        box.header_size = 8;
+    }
+    else {
+        box.size = size32;
+        box.header_size = 8;
+    }
+    if (box.size < box.header_size) return false;
+    // truncated file: keep what is there
+    if (box.size > limit - offset) box.size = limit - offset;
+    return true;
+}
+
+bool MP4BoxParser::parse(const uint8_t* buffer, size_t length, uint64_t file_size) {
+    data = buffer;
+    size = length;
+    base_offset = 0;
+    sample_limit = file_size ? file_size : length;
+    fragmented = false;
+    top_level.clear();
+    tracks.clear();
+    defaults.clear();
+    fragments.clear();
+
+    uint64_t offset = 0;
+    Box box;
+    while (offset < size && readBoxHeader(data, offset, size, box)) {
+        top_level.push_back(box);
+        if (box.type == MP4_FOURCC('m', 'o', 'o', 'v')) {
+            parseContainer(box.offset + box.header_size, box.offset + box.size, nullptr);
+        }
+        else if (box.type == MP4_FOURCC('m', 'o', 'o', 'f')) {
+            parseMoof(box);
+        }
+        offset += box.size;
+    }
+
+    // the top level must start at 0 and contain at least one of the core boxes
+    bool has_core = false;
+    for (const Box& b : top_level) {
+        if (b.type == MP4_FOURCC('f', 't', 'y', 'p') || b.type == MP4_FOURCC('m', 'o', 'o', 'v') ||
+            b.type == MP4_FOURCC('m', 'd', 'a', 't') || b.type == MP4_FOURCC('m', 'o', 'o', 'f')) {
+            has_core = true;
+        }
+    }
+    return has_core;
+}
+
+bool MP4BoxParser::parseFragment(const uint8_t* moof, size_t length, uint64_t moof_offset, uint64_t file_size) {
+    data = moof;
+    size = length;
+    base_offset = moof_offset;
+    sample_limit = file_size;
+    Box box;
+    if (!readBoxHeader(data, 0, size, box) || box.type != MP4_FOURCC('m', 'o', 'o', 'f')) return false;
+    parseMoof(box);
+    return true;
+}
+
+void MP4BoxParser::clearSamples() {
+    for (Track& t : tracks) vector<Sample>().swap(t.samples);
+    fragments.clear();
+}
+
+vector<MP4BoxParser::Box> MP4BoxParser::findTopLevel(uint32_t type) const {
+    vector<Box> result;
+    for (const Box& b : top_level) {
+        if (b.type == type) result.push_back(b);
+    }
+    return result;
+}
+
+bool MP4BoxParser::hasSampleTables() const {
+    for (const Track& t : tracks) {
+        if (!t.samples.empty()) return true;
+    }
+    return false;
+}
+
+void MP4BoxParser::parseContainer(uint64_t begin, uint64_t end, Track* track) {
+    uint64_t offset = begin;
+    Box box;
+    while (offset < end && readBoxHeader(data, offset, end, box)) {
+        const uint8_t* payload = data + box.offset + box.header_size;
+        uint64_t payload_size = box.size - box.header_size;
+        switch (box.type) {
+        case MP4_FOURCC('t', 'r', 'a', 'k'):
+            parseTrak(box);
+            break;
+        case MP4_FOURCC('m', 'd', 'i', 'a'):
+        case MP4_FOURCC('m', 'i', 'n', 'f'):
+            parseContainer(box.offset + box.header_size, box.offset + box.size, track);
+            break;
+        case MP4_FOURCC('m', 'v', 'e', 'x'):
+            fragmented = true;
+            parseContainer(box.offset + box.header_size, box.offset + box.size, track);
+            break;
+        case MP4_FOURCC('t', 'r', 'e', 'x'):
+            // version/flags, track_ID, description index, duration, size, flags
+            if (payload_size >= 24) defaults.push_back({ readU32(payload + 4), readU32(payload + 16) });
+            break;
+        case MP4_FOURCC('s', 't', 'b', 'l'):
+            if (track) parseStbl(box, *track);
+            break;
+        case MP4_FOURCC('t', 'k', 'h', 'd'):
+            // version 1 has 64-bit creation/modification times
+            if (track && payload_size >= 24) {
+                track->track_id = payload[0] == 1 ? readU32(payload + 20) : readU32(payload + 12);
+            }
+            break;
+        case MP4_FOURCC('h', 'd', 'l', 'r'):
+            // version/flags, pre_defined, handler_type
+            if (track && payload_size >= 12) track->handler = readU32(payload + 8);
+            break;
+        default:
+            break;
+        }
+        offset += box.size;
+    }
+}
+
+void MP4BoxParser::parseTrak(const Box& trak) {
+    Track track;
+    parseContainer(trak.offset + trak.header_size, trak.offset + trak.size, &track);
+    tracks.push_back(std::move(track));
+}
+
+void MP4BoxParser::parseStbl(const Box& stbl, Track& track) {
+    vector<uint32_t> sizes;
+    uint32_t constant_size = 0;
+    uint32_t sample_count = 0;
+    vector<uint64_t> chunk_offsets;
+    vector<StscEntry> stsc;
+
+    uint64_t offset = stbl.offset + stbl.header_size;
+    uint64_t end = stbl.offset + stbl.size;
+    Box box;
+    while (offset < end && readBoxHeader(data, offset, end, box)) {
+        const uint8_t* p = data + box.offset + box.header_size;
+        uint64_t len = box.size - box.header_size;
+        switch (box.type) {
+        case MP4_FOURCC('s', 't', 's', 'd'): {
+            Box entry;
+            // the entry must fit in stsd, its child boxes are looked up inside it
+            if (len >= 16 && readBoxHeader(data, box.offset + box.header_size + 8, box.offset + box.size, entry)) {
+                track.sample_entry = entry.type;
+                parseVisualSampleEntry(entry, track);
+            }
+            break;
+        }
+        case MP4_FOURCC('s', 't', 's', 'z'): {
+            if (len < 12) break;
+            constant_size = readU32(p + 4);
+            sample_count = min<uint32_t>(readU32(p + 8), MP4_MAX_TABLE_ENTRIES);
+            // constant-size samples have no table to bound the count, the file does
+            if (constant_size) sample_count = (uint32_t)min<uint64_t>(sample_count, sample_limit / constant_size);
+            if (constant_size == 0) {
+                sample_count = (uint32_t)min<uint64_t>(sample_count, (len - 12) / 4);
+                sizes.resize(sample_count);
+                for (uint32_t i = 0; i < sample_count; i++) sizes[i] = readU32(p + 12 + 4 * (size_t)i);
+            }
+            break;
+        }
+        case MP4_FOURCC('s', 't', 'z', '2'): {
+            if (len < 12) break;
+            uint8_t field_size = p[7];
+            if (field_size != 4 && field_size != 8 && field_size != 16) break;
+            sample_count = min<uint32_t>(readU32(p + 8), MP4_MAX_TABLE_ENTRIES);
+            sample_count = (uint32_t)min<uint64_t>(sample_count, (len - 12) * 8 / field_size);
+            sizes.resize(sample_count);
+            for (uint32_t i = 0; i < sample_count; i++) {
+                const uint8_t* q = p + 12;
+                if (field_size == 16) sizes[i] = readU16(q + 2 * (size_t)i);
+                else if (field_size == 8) sizes[i] = q[i];
+                else sizes[i] = (i & 1) ? (q[i / 2] & 0x0F) : (q[i / 2] >> 4);
+            }
+            break;
+        }
+        case MP4_FOURCC('s', 't', 'c', 'o'):
+        case MP4_FOURCC('c', 'o', '6', '4'): {
+            if (len < 8) break;
+            size_t entry_size = box.type == MP4_FOURCC('c', 'o', '6', '4') ? 8 : 4;
+            uint64_t count = min<uint64_t>(min<uint64_t>(readU32(p + 4), MP4_MAX_TABLE_ENTRIES), (len - 8) / entry_size);
+            chunk_offsets.resize((size_t)count);
+            for (size_t i = 0; i < count; i++) {
+                chunk_offsets[i] = entry_size == 8 ? readU64(p + 8 + 8 * i) : readU32(p + 8 + 4 * i);
+            }
+            break;
+        }
+        case MP4_FOURCC('s', 't', 's', 'c'): {
+            if (len < 8) break;
+            uint64_t count = min<uint64_t>(min<uint64_t>(readU32(p + 4), MP4_MAX_TABLE_ENTRIES), (len - 8) / 12);
+            stsc.resize((size_t)count);
+            for (size_t i = 0; i < count; i++) {
+                stsc[i].first_chunk = readU32(p + 8 + 12 * i);
+                stsc[i].samples_per_chunk = readU32(p + 12 + 12 * i);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        offset += box.size;
+    }
+
+    // walk chunks run by run and lay the samples out inside each chunk
+    track.samples.clear();
+    // no more samples than the chunk runs can hold
+    uint64_t run_samples = 0;
+    for (size_t e = 0; e < stsc.size() && run_samples < sample_count; e++) {
+        uint64_t first = stsc[e].first_chunk;
+        uint64_t last = e + 1 < stsc.size() ? (uint64_t)stsc[e + 1].first_chunk - 1 : chunk_offsets.size();
+        last = min<uint64_t>(last, chunk_offsets.size());
+        if (first == 0 || first > last) continue;
+        run_samples += (last - first + 1) * stsc[e].samples_per_chunk;
+    }
+    track.samples.reserve((size_t)min<uint64_t>(sample_count, run_samples));
+    uint32_t sample = 0;
+    for (size_t e = 0; e < stsc.size() && sample < sample_count; e++) {
+        uint64_t first = stsc[e].first_chunk;
+        uint64_t last = e + 1 < stsc.size() ? (uint64_t)stsc[e + 1].first_chunk - 1 : chunk_offsets.size();
+        if (first == 0 || first > last) continue;
+        last = min<uint64_t>(last, chunk_offsets.size());
+        for (uint64_t c = first; c <= last && sample < sample_count; c++) {
+            uint64_t pos = chunk_offsets[(size_t)c - 1];
+            for (uint32_t k = 0; k < stsc[e].samples_per_chunk && sample < sample_count; k++, sample++) {
+                // a chunk that runs out of the file is damaged: its remaining samples are dropped
+                if (pos > sample_limit) {
+                    sample += (uint32_t)min<uint64_t>(stsc[e].samples_per_chunk - k, sample_count - sample);
+                    break;
+                }
+                uint32_t sample_size = constant_size ? constant_size : sizes[sample];
+                // samples outside the file are dropped, the table is damaged
+                if (sample_size <= sample_limit - pos) {
+                    track.samples.push_back({ pos, sample_size });
+                }
+                pos += sample_size;
+            }
+        }
+    }
+}
+
+void MP4BoxParser::parseVisualSampleEntry(const Box& entry, Track& track) {
+    switch (entry.type) {
+    case MP4_FOURCC('a', 'v', 'c', '1'):
+    case MP4_FOURCC('a', 'v', 'c', '3'):
+    case MP4_FOURCC('h', 'v', 'c', '1'):
+    case MP4_FOURCC('h', 'e', 'v', '1'):
+        break;
+    default:
+        return;
+    }
+    uint64_t offset = entry.offset + entry.header_size + MP4_VISUAL_SAMPLE_ENTRY_SIZE;
+    uint64_t end = entry.offset + entry.size;
+    Box box;
+    while (offset < end && readBoxHeader(data, offset, end, box)) {
+        const uint8_t* p = data + box.offset + box.header_size;
+        uint64_t len = box.size - box.header_size;
+        // AVCDecoderConfigurationRecord: lengthSizeMinusOne in the low bits of byte 4,
+        // HEVCDecoderConfigurationRecord: in the low bits of byte 21
+        if (box.type == MP4_FOURCC('a', 'v', 'c', 'C') && len >= 5) {
+            track.codec_config = box.type;
+            track.nal_length_size = (p[4] & 3) + 1;
+        }
+        else if (box.type == MP4_FOURCC('h', 'v', 'c', 'C') && len >= 22) {
+            track.codec_config = box.type;
+            track.nal_length_size = (p[21] & 3) + 1;
+        }
+        offset += box.size;
+    }
+    // a 3-byte length is not allowed
+    if (track.nal_length_size == 3) track.nal_length_size = 0;
+}
+
+MP4BoxParser::Track& MP4BoxParser::trackById(uint32_t track_id) {
+    for (Track& t : tracks) {
+        if (t.track_id == track_id) return t;
+    }
+    // a fragment without its moov: the handler stays unknown
+    Track track;
+    track.track_id = track_id;
+    tracks.push_back(std::move(track));
+    return tracks.back();
+}
+
+void MP4BoxParser::parseMoof(const Box& moof) {
+    fragmented = true;
+    uint64_t moof_offset = base_offset + moof.offset;
+    // without an explicit base the data of a traf follows the data of the previous one,
+    // the first traf starts at the moof
+    uint64_t data_end = moof_offset;
+    Fragment fragment = { moof_offset, moof.size, 0 };
+
+    uint64_t offset = moof.offset + moof.header_size;
+    uint64_t end = moof.offset + moof.size;
+    Box box;
+    while (offset < end && readBoxHeader(data, offset, end, box)) {
+        if (box.type == MP4_FOURCC('t', 'r', 'a', 'f')) {
+            fragment.sample_count += parseTraf(box, moof_offset, data_end);
+        }
+        offset += box.size;
+    }
+    fragments.push_back(fragment);
+}
+
+uint64_t MP4BoxParser::parseTraf(const Box& traf, uint64_t moof_offset, uint64_t& data_end) {
+    Track* track = nullptr;
+    uint64_t base = data_end;
+    uint64_t run_end = data_end;
+    uint32_t default_size = 0;
+    uint64_t added = 0;
+
+    uint64_t offset = traf.offset + traf.header_size;
+    uint64_t end = traf.offset + traf.size;
+    Box box;
+    while (offset < end && readBoxHeader(data, offset, end, box)) {
+        const uint8_t* p = data + box.offset + box.header_size;
+        uint64_t len = box.size - box.header_size;
+        if (box.type == MP4_FOURCC('t', 'f', 'h', 'd') && len >= 8) {
+            uint32_t flags = readU32(p) & 0xFFFFFF;
+            uint32_t track_id = readU32(p + 4);
+            track = &trackById(track_id);
+            for (const TrackDefaults& d : defaults) {
+                if (d.track_id == track_id) default_size = d.sample_size;
+            }
+            // optional fields in this order: base_data_offset, sample_description_index,
+            // default_sample_duration, default_sample_size, default_sample_flags
+            uint64_t q = 8;
+            if (flags & 0x000001) {
+                if (len >= q + 8) base = readU64(p + q);
+                q += 8;
+            }
+            else if (flags & 0x020000) {
+                // default-base-is-moof
+                base = moof_offset;
+            }
+            if (flags & 0x000002) q += 4;
+            if (flags & 0x000008) q += 4;
+            if ((flags & 0x000010) && len >= q + 4) default_size = readU32(p + q);
+            run_end = base;
+        }
+        else if (box.type == MP4_FOURCC('t', 'r', 'u', 'n') && track && len >= 8) {
+            uint32_t flags = readU32(p) & 0xFFFFFF;
+            uint64_t count = min<uint32_t>(readU32(p + 4), MP4_MAX_TABLE_ENTRIES);
+            uint64_t q = 8;
+            // a run without data_offset continues where the previous run of the traf ended
+            uint64_t pos = run_end;
+            if (flags & 0x000001) {
+                if (len < q + 4) break;
+                pos = base + (int64_t)readI32(p + q);
+                q += 4;
+            }
+            if (flags & 0x000004) q += 4;
+            // per sample: duration, size, flags, composition time offset; the size follows the duration
+            uint64_t duration_size = (flags & 0x000100) ? 4 : 0;
+            uint64_t entry_size = duration_size + ((flags & 0x000200) ? 4 : 0) + ((flags & 0x000400) ? 4 : 0) + ((flags & 0x000800) ? 4 : 0);
+            if (q > len) break;
+            if (entry_size) count = min<uint64_t>(count, (len - q) / entry_size);
+            // a run of default-size samples only has the rest of the file to cover
+            else count = default_size && pos < sample_limit ? min<uint64_t>(count, (sample_limit - pos) / default_size) : 0;
+            track->samples.reserve(track->samples.size() + (size_t)count);
+            for (uint64_t i = 0; i < count; i++) {
+                // a run that leaves the file is damaged: the rest of it is dropped
+                if (pos > sample_limit) break;
+                uint32_t sample_size = (flags & 0x000200) ? readU32(p + q + i * entry_size + duration_size) : default_size;
+                // samples outside the file are dropped, the run is damaged
+                if (sample_size && sample_size <= sample_limit - pos) {
+                    track->samples.push_back({ pos, sample_size });
+                    added++;
+                }
+                pos += sample_size;
+            }
+            run_end = pos;
+        }
+        offset += box.size;
+    }
+    data_end = max(data_end, run_end);
+    return added;
+}
@@ -0,0 +1,125 @@
+// MP4BoxParser.h
+#ifndef MP4BOXPARSER_H
+#define MP4BOXPARSER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+
+// build a FourCC value from four characters
+#define MP4_FOURCC(a, b, c, d) ((uint32_t(uint8_t(a)) << 24) | (uint32_t(uint8_t(b)) << 16) | (uint32_t(uint8_t(c)) << 8) | uint32_t(uint8_t(d)))
+// upper bound for table entries, guards against absurd counts in damaged files
+#define MP4_MAX_TABLE_ENTRIES (1u << 28)
+// fixed fields of a VisualSampleEntry in front of its child boxes (ISO 14496-12 12.1.3)
+#define MP4_VISUAL_SAMPLE_ENTRY_SIZE 78
+
+/**
+*  MP4BoxParser
+* @brief Walks the ISO-BMFF box tree and resolves every track's samples from its sample table.
+* @details Top-level boxes are visited by their size fields (32-bit, 64-bit largesize and
+*  size 0 = "to end of file"), moov/trak/mdia/minf/stbl are descended, and stsz/stz2 together
+*  with stco/co64 and stsc give the exact file offset and size of every sample. Fragmented
+*  files add their samples from every moof: tfhd gives the base offset and default size of a
+*  traf (falling back to the trex defaults of moov/mvex), each trun the data offset and sizes of
+*  a run. The avcC/hvcC of a video sample entry gives the NAL length prefix size needed to
+*  walk the NAL units inside the samples. Nothing is found by scanning payload bytes, so the cost is O(boxes + samples).
+* @author AXIS5 with assistance from LLM
+*/
+class MP4BoxParser {
+public:
+    struct Box {
+        uint64_t offset;        // first byte of the box header
+        uint64_t size;          // total size including header
+        uint32_t header_size;   // 8, or 16 with largesize
+        uint32_t type;          // FourCC
+    };
+
+    struct Sample {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    struct Track {
+        uint32_t track_id = 0;
+        uint32_t handler = 0;       // 'vide', 'soun', ...
+        uint32_t sample_entry = 0;  // first stsd entry: 'avc1', 'hvc1', 'mp4a', ...
+        uint32_t codec_config = 0;  // 'avcC' or 'hvcC' of that entry, 0 if none
+        uint8_t nal_length_size = 0;// bytes of the NAL unit length prefix (lengthSizeMinusOne + 1), 0 = no NAL stream
+        vector<Sample> samples;     // in decoding order
+    };
+
+    struct Fragment {
+        uint64_t moof_offset;
+        uint64_t moof_size;
+        uint64_t sample_count;      // samples of all its trafs
+    };
+
+    //parse the whole buffer; false if the top level is not a sane box sequence.
+    //samples must end within file_size (0 = the buffer), a moov parsed on its own passes the real file size
+    bool parse(const uint8_t* data, size_t size, uint64_t file_size = 0);
+
+    //parse one moof box on its own (moof_offset = its offset in the file) while streaming; the
+    //samples are appended to the tracks of the last parse(), whose trex defaults apply
+    bool parseFragment(const uint8_t* moof, size_t size, uint64_t moof_offset, uint64_t file_size = UINT64_MAX);
+
+    //drop the samples of all tracks, keep tracks and trex defaults (between streamed fragments)
+    void clearSamples();
+
+    const vector<Box>& topLevelBoxes() const { return top_level; }
+    const vector<Track>& getTracks() const { return tracks; }
+    const vector<Fragment>& getFragments() const { return fragments; }
+
+    //moov announced fragments (mvex) or a moof was seen
+    bool isFragmented() const { return fragmented; }
+
+    //top-level boxes of one type
+    vector<Box> findTopLevel(uint32_t type) const;
+
+    //at least one track with samples was resolved
+    bool hasSampleTables() const;
+
+    //read the box header at offset; false if it does not fit into [offset, limit)
+    static bool readBoxHeader(const uint8_t* data, uint64_t offset, uint64_t limit, Box& box);
+
+    static uint32_t readU32(const uint8_t* p) {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    static uint64_t readU64(const uint8_t* p) {
+        return (uint64_t(readU32(p)) << 32) | readU32(p + 4);
+    }
+    static int32_t readI32(const uint8_t* p) {
+        return (int32_t)readU32(p);
+    }
+    static uint16_t readU16(const uint8_t* p) {
+        return uint16_t((p[0] << 8) | p[1]);
+    }
+
+private:
+    // trex: per track defaults of the fragments
+    struct TrackDefaults {
+        uint32_t track_id;
+        uint32_t sample_size;
+    };
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    uint64_t base_offset = 0;       // file offset of data[0]
+    uint64_t sample_limit = 0;
+    bool fragmented = false;
+    vector<Box> top_level;
+    vector<Track> tracks;
+    vector<TrackDefaults> defaults;
+    vector<Fragment> fragments;
+
+    void parseContainer(uint64_t begin, uint64_t end, Track* track);
+    void parseTrak(const Box& trak);
+    void parseStbl(const Box& stbl, Track& track);
+    void parseVisualSampleEntry(const Box& entry, Track& track);
+    void parseMoof(const Box& moof);
+    uint64_t parseTraf(const Box& traf, uint64_t moof_offset, uint64_t& data_end);
+    Track& trackById(uint32_t track_id);
+};
+
+#endif // !MP4BOXPARSER_H
@@ -5,34 +5,89 @@
 
 using namespace std;
 
+// names of the operations picked by planGlitch, by op id
+static const vector<string> MP4_OPERATION_NAMES = { "bitflip", "lowbits", "zero", "shift", "lag", "invert", "copy" };
 
-bool MP4Corruptor::loadFile(const std::string& filename) {
+
+bool MP4Corruptor::readFile(const std::string& filename) {
     string file_ext = filename.substr(filename.find_last_of('.') + 1);
     if (file_ext != "mp4" && file_ext != "MP4") {
         std::cerr << "Error: Not an MP4 file: " << filename << std::endl;
         return false;
     }
-    ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open file: " << filename << std::endl;
+    if (!readFileData(filename)) {
+        cerr << "读取文件失败" << std::endl;
         return false;
     }
+    return true;
+}
 
-    streamsize size = file.tellg();
-    //move cursor to beginning
-    file.seekg(0, ios::beg);
-
-    file_data.resize(size);
-    if (!file.read(reinterpret_cast<char*>(file_data.data()), size)) {
+bool MP4Corruptor::analyze() {
+    auto start_time = chrono::steady_clock::now();
+    metrics.format = "mp4";
+    size_t size = file_data.size();
+    // a file that does not start with a box has no box tree and goes to the signature scan,
+    // which then runs on the chunks already read while the rest is loading (not with the
+    // sidecar, it hashes the whole file)
+    MP4BoxParser::Box first_box;
+    size_t head = file_data.waitLoaded(min<size_t>(16, size));
+    early_scan = file_data.loading() && !use_analysis_cache &&
+        !MP4BoxParser::readBoxHeader(file_data.data(), 0, head, first_box);
+    if (early_scan) {
+        auto scan_start = chrono::steady_clock::now();
+        scan_hits = scanLoading(scanner);
+        metrics.addScan("signature", size, scan_hits.size(), CorruptionMetrics::since(scan_start));
+    }
+    if (!finishRead()) {
         cerr << "读取文件失败" << std::endl;
         return false;
     }
+    // waiting for the rest of the file counts as read, not as analysis
+    if (!early_scan) start_time = chrono::steady_clock::now();
 	//initialize frame count
     frmcount = 0;
+    AnalysisIndex index;
+    if (loadAnalysis(index, ANALYSIS_FORMAT_MP4)) {
+        has_sample_table = (index.flags & 1) != 0;
+        frame_starts.assign(index.frame_starts.begin(), index.frame_starts.end());
+        audio_starts.assign(index.audio_starts.begin(), index.audio_starts.end());
+        nal_index.clear();
+        for (const auto& unit : index.nal_units) nal_index.add(unit);
+        mdat_atoms.clear();
+        for (const auto& r : index.regions) {
+            mdat_atoms.push_back({ (size_t)r.offset, (size_t)r.size, char(r.flags) });
+        }
+        recordAnalysisMetrics(start_time);
+        return true;
+    }
+    // walk the box tree; the signature scan is only needed when there is no usable sample table
+    auto parse_start = chrono::steady_clock::now();
+    has_box_tree = box_parser.parse(file_data.data(), file_data.size());
+    metrics.addScan("box_tree", file_data.size(), box_parser.topLevelBoxes().size(), CorruptionMetrics::since(parse_start));
+    if (has_box_tree && box_parser.hasSampleTables()) {
+        scan_hits.clear();
+        log() << "Parsed box tree: " << box_parser.topLevelBoxes().size() << " top-level boxes, "
+            << box_parser.getTracks().size() << " tracks" << std::endl;
+        if (box_parser.isFragmented()) {
+            log() << "Fragmented: " << box_parser.getFragments().size() << " moof fragments" << std::endl;
+        }
+    }
+    else {
+        log() << "No usable sample table, falling back to signature scan" << std::endl;
+        // one pass for all signatures, in chunks across the threads
+        if (!early_scan) {
+            auto scan_start = chrono::steady_clock::now();
+            scan_hits = scanFile(scanner);
+            metrics.addScan("signature", file_data.size(), scan_hits.size(), CorruptionMetrics::since(scan_start));
+        }
+    }
     mdat_atoms = getMdatInfo();
 
-    for(size_t i=0;i<mdat_atoms.size();i++){
-        cout << "Found mdat atom at offset " << mdat_atoms[i].offset 
+    if (mdat_atoms.size() > MP4_MAX_LISTED_MDATS) {
+        log() << "Found " << mdat_atoms.size() << " mdat atoms" << std::endl;
+    }
+    for(size_t i=0;i<mdat_atoms.size() && mdat_atoms.size() <= MP4_MAX_LISTED_MDATS;i++){
+        log() << "Found mdat atom at offset " << mdat_atoms[i].offset 
              << " with size " << mdat_atoms[i].size 
              << (mdat_atoms[i].if_extended ? " (64-bit size)" : " (32-bit size)") << std::endl;
 	}
@@ -40,169 +95,165 @@ bool MP4Corruptor::loadFile(const std::string& filename) {
 	// compute protected mask
     precomputeProtectedMask();
 
-    cout << "成功加载文件，大小: " << size << " 字节" << std::endl;
+    index.format = ANALYSIS_FORMAT_MP4;
+    index.flags = has_sample_table ? 1 : 0;
+    index.frame_count = frmcount;
+    index.protected_ranges.assign(protected_ranges.begin(), protected_ranges.end());
+    index.frame_starts.assign(frame_starts.begin(), frame_starts.end());
+    index.audio_starts.assign(audio_starts.begin(), audio_starts.end());
+    index.nal_units = nal_index.units();
+    for (const auto& mdat : mdat_atoms) {
+        index.regions.push_back({ mdat.offset, mdat.size, (uint32_t)mdat.if_extended });
+    }
+    saveAnalysis(index);
+    recordAnalysisMetrics(start_time);
+
+    log() << "成功加载文件，大小: " << size << " 字节"
+        << (file_data.isMapped() ? " (memory-mapped)" : "") << std::endl;
     return true;
 }
 
 
+void MP4Corruptor::recordAnalysisMetrics(std::chrono::steady_clock::time_point start_time) {
+    metrics.protected_bytes = protected_ranges.coveredBytes();
+    metrics.frames = frame_starts.size();
+    metrics.audio_frames = audio_starts.size();
+    metrics.addPhase("analyze", CorruptionMetrics::since(start_time));
+}
+
 bool MP4Corruptor::saveFile(const std::string& filename) {
-    ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
+    auto start_time = chrono::steady_clock::now();
+    bool ok = file_data.save(filename);
+    metrics.addPhase("save", CorruptionMetrics::since(start_time));
+    metrics.save_method = file_data.saveMethod();
+    metrics.saved_bytes = file_data.savedBytes();
+    if (!ok) {
         std::cerr << "无法创建输出文件: " << filename << std::endl;
         return false;
     }
-
-    file.write(reinterpret_cast<const char*>(file_data.data()), file_data.size());
     return true;
 }
 
 //get mdat info
 vector<MP4Corruptor::MdatInfo> MP4Corruptor::getMdatInfo() {
 	vector<MdatInfo> mdat_atoms;
-    size_t file_size = file_data.size();
-    // find mdat atom in file
 
-    for (size_t i = 0; i < file_size - 8; ++i) {
-        MdatInfo info = { 0, 0 ,0};
-		// check mdat signature
-        if (file_data[i] == 'm' && file_data[i + 1] == 'd' &&
-            file_data[i + 2] == 'a' && file_data[i + 3] == 't') {
-
-			//cout << "found mdat at " << i << endl;
-            
-            // atom_size includes header size
-            uint32_t atom_size = (file_data[i - 4] << 24) |
-                (file_data[i - 3] << 16) |
-                (file_data[i - 2] << 8) |
-                file_data[i - 1];
-
-
-			// if 64-bit size
-            if (atom_size == 1) {
-                if (i + 16 > file_size) break; // 
-                uint64_t extended_size =
-                    ((uint64_t)file_data[i + 8] << 56) |
-                    ((uint64_t)file_data[i + 9] << 48) |
-                    ((uint64_t)file_data[i + 10] << 40) |
-                    ((uint64_t)file_data[i + 11] << 32) |
-                    ((uint64_t)file_data[i + 12] << 24) |
-                    ((uint64_t)file_data[i + 13] << 16) |
-                    ((uint64_t)file_data[i + 14] << 8) |
-                    ((uint64_t)file_data[i + 15]);
-                info.size = extended_size; // 16字节头部
-                info.offset = i - 8; // 原子头起始位置
-                info.if_extended = 1;
-            }
-            else {
-                info.size = atom_size;
-                info.offset = i - 4; // 原子头起始位置
-                info.if_extended = 0;
-            }
+    // exact top-level mdat boxes from the box tree
+    if (has_box_tree) {
+        for (const auto& box : box_parser.findTopLevel(MP4_FOURCC('m', 'd', 'a', 't'))) {
+            MdatInfo info = { (size_t)box.offset, (size_t)box.size, char(box.header_size == 16 ? 1 : 0) };
             mdat_atoms.push_back(info);
         }
+        return mdat_atoms;
+    }
+
+    // find mdat atom in file
 
+    for (const auto& hit : scan_hits) {
+        size_t i = hit.offset;
+        // the size field sits in front of the signature; 64-bit largesize and size 0 (to the end) included
+        MP4BoxParser::Box box;
+        if (hit.type == MP4_SIG_MDAT && i >= 4 &&
+            MP4BoxParser::readBoxHeader(file_data.data(), i - 4, file_data.size(), box)) {
+            MdatInfo info = { (size_t)box.offset, (size_t)box.size, char(box.header_size == 16 ? 1 : 0) };
+            mdat_atoms.push_back(info);
+        }
     }
     return mdat_atoms;
 }
 
 void MP4Corruptor::precomputeProtectedMask() {
-    protected_mask.resize(file_data.size(), false);
+    protected_ranges.clear();
 
     // protect file header
-    for (size_t i = 0; i < min(size_t(1024), file_data.size()); i++) {
-        protected_mask[i] = true;
-    }
-
-    // protect moov atom
-    for (size_t i = 4; i < file_data.size() - 8; i++) {
-        if (file_data[i] == 'm' && file_data[i + 1] == 'o' &&
-            file_data[i + 2] == 'o' && file_data[i + 3] == 'v') {
-            uint32_t atom_size = (file_data[i - 4] << 24) | (file_data[i - 3] << 16) |
-                (file_data[i - 2] << 8) | file_data[i - 1];
-            size_t start = i - 4;
-            size_t end = min(i + atom_size, file_data.size());
-            for (size_t j = start; j < end; j++) {
-                if (j < protected_mask.size()) protected_mask[j] = true;
+    protected_ranges.add(0, min(size_t(1024), file_data.size()));
+
+    // protect every top-level box except the media data (ftyp, moov, free, ...)
+    if (has_box_tree) {
+        for (const auto& box : box_parser.topLevelBoxes()) {
+            if (box.type != MP4_FOURCC('m', 'd', 'a', 't')) {
+                protected_ranges.add((size_t)box.offset, (size_t)(box.offset + box.size));
             }
         }
     }
 
-    // protect ftyp atom
-    for (size_t i = 4; i < file_data.size() - 8; i++) {
-        if (file_data[i] == 'f' && file_data[i + 1] == 't' &&
-            file_data[i + 2] == 'y' && file_data[i + 3] == 'p') {
-            uint32_t atom_size = (file_data[i - 4] << 24) | (file_data[i - 3] << 16) |
-                (file_data[i - 2] << 8) | file_data[i - 1];
-            size_t start = i - 4;
-            size_t end = min(i + atom_size, file_data.size());
-            for (size_t j = start; j < end; j++) {
-                if (j < protected_mask.size()) protected_mask[j] = true;
-            }
+    // protect moov and ftyp atoms, sizes read as boxes so largesize counts
+    for (const auto& hit : scan_hits) {
+        size_t i = hit.offset;
+        if ((hit.type != MP4_SIG_MOOV && hit.type != MP4_SIG_FTYP) || i < 4) continue;
+        MP4BoxParser::Box box;
+        if (MP4BoxParser::readBoxHeader(file_data.data(), i - 4, file_data.size(), box)) {
+            protected_ranges.add((size_t)box.offset, (size_t)(box.offset + box.size));
+        }
+        else {
+            protected_ranges.add(i - 4, min(i + 4, file_data.size()));
         }
     }
 
     //protect mdat header
     for(MdatInfo &mdat : mdat_atoms){
-        if (mdat.if_extended == 1) {
-			//16 bytes header
-            for (size_t j = mdat.offset; j < mdat.offset+16 ; j++) {
-                if (j < protected_mask.size()) protected_mask[j] = true;
-            }
-        }
-        else {
-            //8 bytes header
-            for (size_t j = mdat.offset; j < mdat.offset + 8; j++) {
-                if (j < protected_mask.size()) protected_mask[j] = true;
-            }
-        }
+        //16 bytes header if extended, 8 bytes otherwise
+        size_t header_size = mdat.if_extended == 1 ? 16 : 8;
+        protected_ranges.add(mdat.offset, min(mdat.offset + header_size, file_data.size()));
 	}
 
     // protect frame start
-    auto frame_starts = findPotentialFrameStarts();
+    has_sample_table = has_box_tree && box_parser.hasSampleTables();
+    frame_starts = findPotentialFrameStarts();
     frmcount += frame_starts.size();
     for (size_t frame_start : frame_starts) {
         size_t end = min(frame_start + MP4_FRAME_HEADER_PROTECT_SIZE, file_data.size());
-        for (size_t j = frame_start; j < end; j++) {
-            if (j < protected_mask.size()) protected_mask[j] = true;
-        }
+        protected_ranges.add(frame_start, end);
+    }
+
+    // protect the header of every NAL unit, not only the first one of a sample,
+    // and parameter sets as a whole
+    nal_index.clear();
+    if (has_sample_table) walkNalUnits();
+    for (const auto& unit : nal_index.units()) {
+        size_t begin = (size_t)unit.offset - unit.prefix;
+        size_t end = unit.nal_class == NAL_CLASS_PARAMETER ? (size_t)unit.offset + unit.size : begin + MP4_FRAME_HEADER_PROTECT_SIZE;
+        protected_ranges.add(begin, min(end, file_data.size()));
     }
 
     // protect audio frame start
-    auto audio_starts = findPotentialAudioFrameStarts();
+    audio_starts = findPotentialAudioFrameStarts();
     frmcount += audio_starts.size();
     for (size_t audio_start : audio_starts) {
         size_t end = min(audio_start + MP4_AUDIO_FRAME_HEADER_PROTECT_SIZE, file_data.size());
-        for (size_t j = audio_start; j < end; j++) {
-            if (j < protected_mask.size()) protected_mask[j] = true;
-        }
+        protected_ranges.add(audio_start, end);
     }
+    protected_ranges.normalize();
 
-	//protect SPS/PPS NALUs
+	//SPS/PPS NALUs are protected exactly through the NAL index above
     //protectCriticalRegions();
 }
 
 // check potential frame start positions
 vector<size_t> MP4Corruptor::findPotentialFrameStarts() {
+    // exact sample offsets from the sample table
+    if (has_box_tree && box_parser.hasSampleTables()) {
+        return trackSampleStarts(MP4_FOURCC('v', 'i', 'd', 'e'));
+    }
+
 	//stores the potential frame start positions
     std::vector<size_t> frame_starts;
-    for (size_t i = 1024; i < file_data.size() - 8; i++) {
+    size_t next = 1024;
+    for (const auto& hit : scan_hits) {
+        size_t i = hit.offset;
         // 检查NALU起始码
-        if (file_data[i] == 0x00 && file_data[i + 1] == 0x00) {
-			if (file_data[i + 2] == 0x01) { // 3-bit start code
-                frame_starts.push_back(i);
-				i += 3; // skip ahead
-            }
-            else if (i + 3 < file_data.size() && file_data[i + 2] == 0x00 && file_data[i + 3] == 0x01) { 
-                // 4-bit start code
-                frame_starts.push_back(i);
-                i += 4; // skip ahead
-            }
+        if (i < next || i + 8 >= file_data.size()) continue;
+        if (hit.type == MP4_SIG_NALU3) { // 3-bit start code
+            frame_starts.push_back(i);
+            next = i + 4; // skip ahead
+        }
+        else if (hit.type == MP4_SIG_NALU4) {
+            // 4-bit start code
+            frame_starts.push_back(i);
+            next = i + 5; // skip ahead
         }
     }
-
-    // 去重并排序
-    std::sort(frame_starts.begin(), frame_starts.end());
-    frame_starts.erase(std::unique(frame_starts.begin(), frame_starts.end()), frame_starts.end());
+    // scanner hits are already sorted and unique
 
     // 确保帧之间有最小间隔
     std::vector<size_t> filtered_starts;
@@ -220,33 +271,20 @@ vector<size_t> MP4Corruptor::findPotentialFrameStarts() {
 
 // check potential audio frame start positions
 vector<size_t> MP4Corruptor::findPotentialAudioFrameStarts() {
+    // exact sample offsets from the sample table
+    if (has_box_tree && box_parser.hasSampleTables()) {
+        return trackSampleStarts(MP4_FOURCC('s', 'o', 'u', 'n'));
+    }
+
     std::vector<size_t> frame_starts;
 
-    // 查找常见音频帧同步字
-    for (size_t i = 0; i < file_data.size() - 4; i++) {
-        // AAC ADTS同步字 (0xFFFx)
-        if ((file_data[i] == 0xFF) && ((file_data[i + 1] & 0xF0) == 0xF0)) {
-            frame_starts.push_back(i);
-        }
-        // MP3帧同步字 (0xFFEx)
-        else if ((file_data[i] == 0xFF) && ((file_data[i + 1] & 0xE0) == 0xE0)) {
-            frame_starts.push_back(i);
-        }
-        // ALAC帧同步字
-        else if (memcmp(file_data.data() + i, "alac", 4) == 0) {
-            frame_starts.push_back(i);
-        }
-        // FLAC帧同步字 (0xFLAC)
-        else if (i + 4 < file_data.size() &&
-            file_data[i] == 0x66 && file_data[i + 1] == 0x4C &&
-            file_data[i + 2] == 0x61 && file_data[i + 3] == 0x43) {
-            frame_starts.push_back(i);
+    // 查找常见音频帧同步字: AAC ADTS (0xFFFx), MP3 (0xFFEx), ALAC, FLAC
+    for (const auto& hit : scan_hits) {
+        if (hit.type == MP4_SIG_AUDIO && hit.offset + 4 < file_data.size()) {
+            frame_starts.push_back(hit.offset);
         }
     }
-
-    // 去重并排序
-    std::sort(frame_starts.begin(), frame_starts.end());
-    frame_starts.erase(std::unique(frame_starts.begin(), frame_starts.end()), frame_starts.end());
+    // scanner hits are already sorted and unique
 
     // 确保帧之间有最小间隔
     std::vector<size_t> filtered_starts;
@@ -261,96 +299,150 @@ vector<size_t> MP4Corruptor::findPotentialAudioFrameStarts() {
     return filtered_starts;
 }
 
-// 批量破坏函数
-void MP4Corruptor::corruptBytesBatch(const std::vector<size_t>& positions, double intensity, int phase,int burst_size) {
-	phase = phase > 6 ? 6 : phase;
-    std::uniform_int_distribution<int> dist(min(0, (int)phase - 3), phase);
-    std::uniform_int_distribution<int> byte_dist(0, 255);
-    std::uniform_int_distribution<int> flip_dist(0, 7);
-    std::uniform_int_distribution<int> dir_dist(0, 1);
-    std::uniform_int_distribution<int> x_dist(0, 30000);
-
-    int bit_pos;
-    for (size_t pos : positions) {
-
-        if (pos >= file_data.size() || protected_mask[pos]) continue;
-        int rand_val = dist(rng);
-
-        //int rand_val = 6;
-        uint8_t original = file_data[pos];
-        
-        switch (rand_val) {
-        case 0:
-            for (int j = 0; j < burst_size; j++) {
-                // bit flip
-                bit_pos = flip_dist(rng);
-                if (!protected_mask[pos + j])file_data[pos + j] ^= (1 << bit_pos);
-            }
-            break;
-        case 1:
-            for (int j = 0; j < burst_size; j++) {
-                // low bits substitution
-                if (!protected_mask[pos + j]) file_data[pos + j] = (file_data[pos + j] & 0xFC) | (static_cast<uint8_t>(byte_dist(rng)) & 0x03);
-            }
-            break;
-        case 2:
-            for (int j = 0; j < burst_size; j++) {
-                // set to zero
-                if (!protected_mask[pos + j]) file_data[pos + j] = 0;
+// sample start offsets of all tracks with the given handler, sorted
+vector<size_t> MP4Corruptor::trackSampleStarts(uint32_t handler) {
+    vector<size_t> starts;
+    for (const auto& track : box_parser.getTracks()) {
+        if (track.handler != handler) continue;
+        for (const auto& sample : track.samples) {
+            starts.push_back((size_t)sample.offset);
+        }
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+    return starts;
+}
+
+void MP4Corruptor::walkNalUnits() {
+    auto start = chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    size_t damaged = 0;
+    const uint8_t* data = file_data.data();
+    for (const auto& track : box_parser.getTracks()) {
+        if (track.handler != MP4_FOURCC('v', 'i', 'd', 'e') || track.nal_length_size == 0) continue;
+        size_t length_size = track.nal_length_size;
+        bool hevc = track.codec_config == MP4_FOURCC('h', 'v', 'c', 'C');
+        for (const auto& sample : track.samples) {
+            // the parser drops samples outside the file, this walk reads the bytes regardless
+            if (sample.offset > file_data.size() || sample.size > file_data.size() - sample.offset) {
+                damaged++;
+                continue;
             }
-            break;
-        case 3:
-            for (int j = 0; j < burst_size; j++) {
-                // shift
-                if (!protected_mask[pos + j]) {
-                    if (dir_dist(rng)) {
-                        file_data[pos + j] <<= 1;
-                    }
-                    else {
-                        file_data[pos + j] >>= 1;
-                    }
+            size_t pos = (size_t)sample.offset;
+            size_t end = (size_t)sample.offset + sample.size;
+            bytes += sample.size;
+            while (pos + length_size <= end) {
+                size_t nal_size = 0;
+                for (size_t i = 0; i < length_size; i++) nal_size = (nal_size << 8) | data[pos + i];
+                // a length running past the sample: the rest of it is no NAL structure
+                if (nal_size == 0 || nal_size > end - pos - length_size) {
+                    damaged++;
+                    break;
                 }
+                nal_index.add(pos + length_size, (uint32_t)nal_size, data[pos + length_size], hevc, (uint8_t)length_size);
+                pos += length_size + nal_size;
             }
-            break;
-        case 4:
-            // lag simulation
-            for (int j = 0; j < burst_size; j++) {
-                if (!protected_mask[pos + j])file_data[pos + j] = file_data[pos];
-            }
-            break;
-        case 5:
-			// Invert bits (voltage spike simulation)
-            for (int j = 0; j < burst_size; j++) {
-                if (!protected_mask[pos + j])file_data[pos + j] ^= 0xFF;
-            }
-            break;
-        case 6:
-            // copying from previous location
-
-            size_t copy_offset;
-            for (int j = 0; j < burst_size; j++) {
-                copy_offset = 5000 + x_dist(rng);
-                if (!protected_mask[pos + j])file_data[pos + j] = file_data[pos - copy_offset + j];
-            }
-            break;
         }
     }
+    nal_index.sort();
+    metrics.addScan("nal_walk", bytes, nal_index.size(), CorruptionMetrics::since(start));
+    if (!nal_index.empty()) {
+        log() << "NAL units: " << nal_index.size() << " in the video samples ("
+            << nal_index.count(NAL_CLASS_IDR) << " IDR, " << nal_index.count(NAL_CLASS_SLICE) << " other slices, "
+            << nal_index.count(NAL_CLASS_PARAMETER) << " parameter sets)"
+            << (damaged ? ", " + to_string(damaged) + " samples with a broken length chain" : "") << std::endl;
+    }
+}
+
+void MP4Corruptor::addTargetWindows(PositionSampler& sampler, size_t begin, size_t end, unsigned target) const {
+    const auto& units = nal_index.units();
+    // a unit starting before begin may reach into the window
+    size_t i = nal_index.lowerBound(begin);
+    if (i > 0) i--;
+    for (; i < units.size() && units[i].offset < end; i++) {
+        const auto& unit = units[i];
+        if (!(unit.nal_class & target)) continue;
+        size_t from = max(begin, (size_t)unit.offset);
+        size_t to = min(end, (size_t)unit.offset + unit.size);
+        if (from < to) sampler.addWindow(from, to);
+    }
+}
+
+// 批量破坏函数
+size_t MP4Corruptor::stageGlitches(const CorruptionStage& stage) const {
+    return static_cast<size_t>(max(frmcount * stage.intensity, 50 * stage.end_ratio));
+}
+
+void MP4Corruptor::planGlitch(Glitch& g, GlitchRandom& r, uint8_t* operand) {
+    int phase = g.stage > 6 ? 6 : g.stage;
+    g.op = (int16_t)r.between(min(0, phase - 3), phase);
+    switch (g.op) {
+    case 0:     // bit index
+    case 1:     // low bits
+    case 3:     // shift direction
+        r.fillBytes(operand, g.len);
+        break;
+    case 6:
+        // copying from previous location, read before any glitch lands
+        gatherCopySource(g, r, 5000, 30001, operand);
+        break;
+    }
+}
+
+void MP4Corruptor::applyGlitch(const Glitch& g, const uint8_t* operand) {
+    using namespace GlitchKernels;
+    uint8_t* p = file_data.data() + g.pos;
+    switch (g.op) {
+    case 0:
+        // bit flip
+        runKernel(BitFlip{}, p, operand, g.len);
+        break;
+    case 1:
+        // low bits substitution
+        runKernel(Substitute{ 0xFC }, p, operand, g.len);
+        break;
+    case 2:
+        // set to zero
+        runKernel(Fill{ 0 }, p, operand, g.len);
+        break;
+    case 3:
+        // shift
+        runKernel(Shift{ 1 }, p, operand, g.len);
+        break;
+    case 4:
+        // lag simulation
+        runKernel(Fill{ p[0] }, p, operand, g.len);
+        break;
+    case 5:
+        // Invert bits (voltage spike simulation)
+        runKernel(Xor{ 0xFF }, p, operand, g.len);
+        break;
+    case 6:
+        // copying from previous location, gathered by planGlitch
+        runKernel(Copy{}, p, operand, g.len);
+        break;
+    }
 }
 
 void MP4Corruptor::applyCorruption() {
-    std::cout << "Corruption start..." << std::endl;
+    log() << "Corruption start..." << std::endl;
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    auto frame_starts = findPotentialFrameStarts();
-    
-    std::cout << "检测到 " << frame_starts.size() << " 个大于"<<MP4_MIN_FRAME_INTERVAL<<"字节的NALU单元" << std::endl;
-
-    auto audio_starts = findPotentialAudioFrameStarts();
-    std::cout << "检测到 " << audio_starts.size() << " 个可能的音频帧起始位置" << std::endl;
+    if (has_sample_table) {
+        log() << "Sample table: " << frame_starts.size() << " video samples, "
+            << audio_starts.size() << " audio samples" << std::endl;
+    }
+    else {
+        log() << "检测到 " << frame_starts.size() << " 个大于"<<MP4_MIN_FRAME_INTERVAL<<"字节的NALU单元" << std::endl;
+        log() << "检测到 " << audio_starts.size() << " 个可能的音频帧起始位置" << std::endl;
+    }
 
-    for (int i = 0; i < stages.size();i++) {
+    log() << "随机种子: " << seed << std::endl;
+    metrics.beginCorruption(stages.size(), MP4_OPERATION_NAMES);
+    auto plan_start = chrono::steady_clock::now();
+    vector<vector<size_t>> stage_positions(stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
         const auto& stage = stages[i];
-        auto stage_start = std::chrono::high_resolution_clock::now();
         vector<size_t> start_pos_list,end_pos_list,region_size_list;
         size_t start_pos;
         size_t end_pos;
@@ -362,81 +454,76 @@ void MP4Corruptor::applyCorruption() {
 			region_size_list.push_back(end_pos - start_pos);
         }
 
-        size_t glitches = static_cast<size_t>(max(frmcount * stage.intensity, 50* stage.end_ratio));
+        size_t glitches = stageGlitches(stage);
 
-        std::cout << "阶段: " << stage.start_ratio * 100 << "% - "
+        log() << "阶段: " << stage.start_ratio * 100 << "% - "
             << stage.end_ratio * 100 << "%, 强度: " << stage.intensity * 100
             << "%, 目标破坏: " << glitches << " glitch" << std::endl;
 
 
-        // 生成破坏位置
-        vector<size_t> corruption_positions;
-        corruption_positions.reserve(glitches);
-
-		discrete_distribution<int> mdat_select(region_size_list.begin(), region_size_list.end());
-        vector<uniform_int_distribution<size_t>> pos_dist_list;
-        
-        for (int x = 0; x < mdat_atoms.size(); x++) {
-			cout << "mdat:"<<x<<" start position: " << start_pos_list[x] << " - end position: " << end_pos_list[x] << endl;
-			pos_dist_list.push_back(uniform_int_distribution<size_t>(start_pos_list[x], end_pos_list[x] - 1));
-			
+        // 生成破坏位置: drawn directly from the unprotected bytes of all mdat windows, in address
+        // order, so every position is valid and the stage gets exactly its target count
+        // a targeted stage draws from the NAL units of its classes only, the other bytes of the
+        // window are never candidates
+        unsigned target = stage.target & NAL_CLASS_ALL;
+        if (target && nal_index.empty()) {
+            log() << "没有NAL索引, 目标 " << NalIndex::classNames(target) << " 忽略, 使用整个区域" << std::endl;
+            target = 0;
         }
-
-        // 生成所有随机位置
-        for (size_t i = 0; i < glitches; i++) {
-			int mdat_index = mdat_select(rng);
-			
-            size_t pos = pos_dist_list[mdat_index](rng);
-
-            //cout << "current position: " << pos << endl;
-            corruption_positions.push_back(pos);
+        else if (target) {
+            log() << "目标NAL类型: " << NalIndex::classNames(target) << ", " << nal_index.count(target) << " 个NAL单元" << std::endl;
         }
-        
-
-        // 批量破坏所有字节
-        size_t total_processed = 0;
-        size_t report_threshold = min((size_t)MP4_PROGRESS_REPORT_INTERVAL, glitches);
-
-        while (total_processed < glitches) {
-            size_t chunk_size = min(static_cast<size_t>(100), glitches - total_processed);
-            std::vector<size_t> chunk(corruption_positions.begin() + total_processed,
-                corruption_positions.begin() + total_processed + chunk_size);
-
-            corruptBytesBatch(chunk, stage.intensity,i, stage.burst_size);
-            total_processed += chunk_size;
-
-            // 进度报告
-            if (total_processed >= report_threshold) {
-                double progress = static_cast<double>(total_processed) / glitches * 100.0;
-                std::cout << "\r阶段进度: " << fixed << setprecision(2)
-                    << progress << "% (" << total_processed << "/" << glitches << ")";
-                report_threshold += MP4_PROGRESS_REPORT_INTERVAL;
+        PositionSampler sampler(protected_ranges);
+        for (size_t x = 0; x < mdat_atoms.size(); x++) {
+            if (mdat_atoms.size() <= MP4_MAX_LISTED_MDATS) {
+                log() << "mdat:" << x << " start position: " << start_pos_list[x] << " - end position: " << end_pos_list[x] << endl;
             }
+            if (target) addTargetWindows(sampler, start_pos_list[x], min(end_pos_list[x], file_data.size()), target);
+            else sampler.addWindow(start_pos_list[x], min(end_pos_list[x], file_data.size()));
         }
+        stage_positions[i] = sampler.drawSorted(rng, glitches);
+        metrics.stages[i].requested = glitches;
+        metrics.stages[i].drawn = stage_positions[i].size();
+        if (stage_positions[i].size() < glitches) {
+            log() << "阶段区域全部受保护, 跳过" << std::endl;
+        }
+    }
 
-        std::cout << "\n阶段完成: " << glitches << "/" << glitches << std::endl;
-
-        auto stage_end = std::chrono::high_resolution_clock::now();
-        auto stage_duration = std::chrono::duration_cast<std::chrono::milliseconds>(stage_end - stage_start);
-        std::cout << "阶段耗时: " << stage_duration.count() << "ms" << std::endl;
+    // 所有阶段合并成一次从前到后的扫描
+    vector<Glitch> plan;
+    vector<size_t> applied = addGlitchSweep(plan, stage_positions);
+    for (size_t i = 0; i < stages.size(); i++) {
+        log() << "阶段 " << (i + 1) << " 计划: " << applied[i] << "/" << stage_positions[i].size() << std::endl;
     }
 
+    metrics.addPhase("plan", CorruptionMetrics::since(plan_start));
+
+    // 所有阶段一起并行破坏
+    auto apply_start = std::chrono::high_resolution_clock::now();
+    runGlitches(plan);
+    auto apply_end = std::chrono::high_resolution_clock::now();
+    log() << "破坏 " << plan.size() << " 处, 耗时: "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(apply_end - apply_start).count() << "ms" << std::endl;
+
     auto end_time = std::chrono::high_resolution_clock::now();
     auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    std::cout << "破坏完成! 总耗时: " << total_duration.count() << "ms" << std::endl;
+    log() << "破坏完成! 总耗时: " << total_duration.count() << "ms" << std::endl;
 }
 
 void MP4Corruptor::printFileInfo() {
-    std::cout << "文件大小: " << file_data.size() << " 字节" << std::endl;
-    std::cout << "破坏阶段数: " << stages.size() << std::endl;
+    log() << "文件大小: " << file_data.size() << " 字节" << std::endl;
+    log() << "破坏阶段数: " << stages.size() << std::endl;
 
     for (size_t i = 0; i < stages.size(); i++) {
-        std::cout << "阶段 " << i + 1 << ": " << stages[i].start_ratio * 100 << "%-"
+        log() << "阶段 " << i + 1 << ": " << stages[i].start_ratio * 100 << "%-"
             << stages[i].end_ratio * 100 << "%, 强度 " << stages[i].intensity * 100 << "%" << std::endl;
     }
 
-    std::vector<size_t> frame_starts = findPotentialFrameStarts();
-    std::cout << "每个音频/视频帧头部保护字节数: " << MP4_FRAME_HEADER_PROTECT_SIZE << " 字节" << std::endl;
+    if (analysis_cached) {
+        log() << "分析结果来自 " << AnalysisIndex::sidecarPath(source_name) << ": " << frame_starts.size()
+            << " 个视频帧, " << audio_starts.size() << " 个音频帧" << std::endl;
+    }
+    log() << "每个音频/视频帧头部保护字节数: " << MP4_FRAME_HEADER_PROTECT_SIZE << " 字节" << std::endl;
 }
 
 // VPS/SPS/PPS保护（H.264/H.265）
@@ -516,11 +603,7 @@ void MP4Corruptor::protectCriticalRegions() {
         size_t protect_end = std::min(nal_pos + 4 + length + 16, file_data.size());
 
         // 应用保护
-        for (size_t j = protect_start; j < protect_end; ++j) {
-            if (j < protected_mask.size()) {
-                protected_mask[j] = true;
-            }
-        }
+        protected_ranges.add(protect_start, protect_end);
 
         // 跳过当前NAL单元
         i += start_code_len + 1 + length;
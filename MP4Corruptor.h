@@ -6,6 +6,10 @@
 #include <iostream>
 #include <fstream>
 #include "VideoCorruptor.h"
+#include "SignatureScanner.h"
+#include "PositionSampler.h"
+#include "MP4BoxParser.h"
+#include "NalIndex.h"
 #include <iomanip>
 #include <map>
 
@@ -15,8 +19,18 @@
 // 最小帧间隔
 #define MP4_MIN_FRAME_INTERVAL 1024
 #define MP4_MIN_AUDIO_FRAME_INTERVAL 512
-// report every N glitches
-#define MP4_PROGRESS_REPORT_INTERVAL 100
+// fragmented files have hundreds of mdat boxes, beyond this count they are not listed one by one
+#define MP4_MAX_LISTED_MDATS 16
+
+// signature types reported by the scanner
+enum MP4Signature : uint32_t {
+    MP4_SIG_MDAT = 0,   // mdat
+    MP4_SIG_MOOV,       // moov
+    MP4_SIG_FTYP,       // ftyp
+    MP4_SIG_NALU3,      // 00 00 01
+    MP4_SIG_NALU4,      // 00 00 00 01
+    MP4_SIG_AUDIO       // ADTS/MP3 sync words, alac, fLaC
+};
 
 /**
 *  MP4Corruptor
@@ -39,6 +53,22 @@ public:
         {0.70, 0.90, 0.02,3},
         {0.90, 1.00, 0.035,5}
         };
+        addSignatures(scanner);
+    }
+
+    //the signatures of the fallback scan
+    static void addSignatures(SignatureScanner& scanner) {
+        scanner.addPattern(MP4_SIG_MDAT, "mdat", 4);
+        scanner.addPattern(MP4_SIG_MOOV, "moov", 4);
+        scanner.addPattern(MP4_SIG_FTYP, "ftyp", 4);
+        scanner.addPattern(MP4_SIG_NALU3, "\x00\x00\x01", 3);
+        scanner.addPattern(MP4_SIG_NALU4, "\x00\x00\x00\x01", 4);
+        // AAC ADTS (0xFFFx) is a subset of the MP3 sync word (0xFFEx)
+        const uint8_t sync_value[] = { 0xFF, 0xE0 };
+        const uint8_t sync_mask[] = { 0xFF, 0xE0 };
+        scanner.addPattern(MP4_SIG_AUDIO, sync_value, sync_mask, 2);
+        scanner.addPattern(MP4_SIG_AUDIO, "alac", 4);
+        scanner.addPattern(MP4_SIG_AUDIO, "fLaC", 4);
     }
 
     struct MdatInfo {
@@ -50,7 +80,9 @@ public:
 	vector<MdatInfo> mdat_atoms;
 
 	//Load MP4 file into memory
-    bool loadFile(const string& filename) override;
+    bool readFile(const string& filename) override;
+
+    bool analyze() override;
 
 	//Save corrupted MP4 file to disk
     bool saveFile(const string& filename) override;
@@ -59,6 +91,21 @@ public:
 
     void printFileInfo() override;
 private:
+    SignatureScanner scanner;
+    // all signature hits of the loaded file, sorted by offset (only without a sample table)
+    vector<SignatureScanner::Hit> scan_hits;
+    // scan_hits were collected while the file was still loading
+    bool early_scan = false;
+    MP4BoxParser box_parser;
+    // the top level parsed as a valid box sequence
+    bool has_box_tree = false;
+    // frame offsets come from the sample tables (not from the scan)
+    bool has_sample_table = false;
+    // analysis result used by applyCorruption, computed or loaded from the sidecar
+    vector<size_t> frame_starts;
+    vector<size_t> audio_starts;
+    // every NAL unit of the video samples, walked by the avcC/hvcC length size
+    NalIndex nal_index;
 
     // 新增关键区域保护
     //void protectCriticalRegions();
@@ -73,7 +120,21 @@ private:
     
     vector<MdatInfo> getMdatInfo();
 
-    void corruptBytesBatch(const std::vector<size_t>& positions, double intensity, int phase,int burst_size);
+    // sample start offsets of all tracks with the given handler ('vide', 'soun')
+    vector<size_t> trackSampleStarts(uint32_t handler);
+
+    // index the NAL units inside the video samples by following the length prefixes; O(NAL units)
+    void walkNalUnits();
+
+    // add the unprotected bytes of the units of the target classes inside [begin, end)
+    void addTargetWindows(PositionSampler& sampler, size_t begin, size_t end, unsigned target) const;
+
+    // protected bytes, frames and analysis time into the metrics
+    void recordAnalysisMetrics(std::chrono::steady_clock::time_point start_time);
+
+    size_t stageGlitches(const CorruptionStage& stage) const override;
+    void planGlitch(Glitch& g, GlitchRandom& r, uint8_t* operand) override;
+    void applyGlitch(const Glitch& g, const uint8_t* operand) override;
 };
 
 #endif // !MP4CORRUPTOR_H
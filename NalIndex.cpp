@@ -0,0 +1,79 @@
+// NalIndex.cpp
+#include "NalIndex.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    struct ClassName {
+        const char* name;
+        unsigned mask;
+    };
+
+    const ClassName CLASS_NAMES[] = {
+        { "idr", NAL_CLASS_IDR },
+        { "slices", NAL_CLASS_SLICE },
+        { "params", NAL_CLASS_PARAMETER },
+        { "other", NAL_CLASS_OTHER },
+        { "all", NAL_CLASS_ALL },
+    };
+}
+
+void NalIndex::sort() {
+    std::sort(list.begin(), list.end(), [](const Unit& a, const Unit& b) { return a.offset < b.offset; });
+}
+
+size_t NalIndex::lowerBound(uint64_t pos) const {
+    return lower_bound(list.begin(), list.end(), pos,
+        [](const Unit& u, uint64_t p) { return u.offset < p; }) - list.begin();
+}
+
+size_t NalIndex::count(unsigned mask) const {
+    size_t n = 0;
+    for (const Unit& u : list) {
+        if (u.nal_class & mask) n++;
+    }
+    return n;
+}
+
+uint8_t NalIndex::classify(uint8_t type, bool hevc) {
+    if (hevc) {
+        // 0-9 trailing/TSA/STSA/RADL/RASL, 16-21 IRAP, 32-34 VPS/SPS/PPS
+        if (type >= 16 && type <= 21) return NAL_CLASS_IDR;
+        if (type <= 9) return NAL_CLASS_SLICE;
+        if (type >= 32 && type <= 34) return NAL_CLASS_PARAMETER;
+        return NAL_CLASS_OTHER;
+    }
+    // 5 IDR, 1-4 non-IDR slice and partitions, 7/8 SPS/PPS, 13 SPS extension, 15 subset SPS
+    if (type == 5) return NAL_CLASS_IDR;
+    if (type >= 1 && type <= 4) return NAL_CLASS_SLICE;
+    if (type == 7 || type == 8 || type == 13 || type == 15) return NAL_CLASS_PARAMETER;
+    return NAL_CLASS_OTHER;
+}
+
+unsigned NalIndex::parseClasses(const string& names) {
+    unsigned mask = 0;
+    size_t begin = 0;
+    while (begin <= names.size()) {
+        size_t end = names.find(',', begin);
+        if (end == string::npos) end = names.size();
+        string name = names.substr(begin, end - begin);
+        unsigned found = 0;
+        for (const ClassName& c : CLASS_NAMES) {
+            if (name == c.name) found = c.mask;
+        }
+        if (!found) return 0;
+        mask |= found;
+        begin = end + 1;
+    }
+    return mask;
+}
+
+string NalIndex::classNames(unsigned mask) {
+    if ((mask & NAL_CLASS_ALL) == NAL_CLASS_ALL) return "all";
+    string names;
+    for (const ClassName& c : CLASS_NAMES) {
+        if (c.mask != NAL_CLASS_ALL && (mask & c.mask)) names += (names.empty() ? "" : ",") + string(c.name);
+    }
+    return names;
+}
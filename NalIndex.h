@@ -0,0 +1,74 @@
+// NalIndex.h
+#ifndef NALINDEX_H
+#define NALINDEX_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+using std::string;
+
+// NAL unit classes, a stage targets a combination of them (CorruptionStage::target)
+#define NAL_CLASS_IDR       1u  // IDR slices, H.265 IRAP (BLA/IDR/CRA)
+#define NAL_CLASS_SLICE     2u  // all other slices (P/B, H.265 trailing/leading pictures)
+#define NAL_CLASS_PARAMETER 4u  // SPS/PPS, H.265 VPS/SPS/PPS
+#define NAL_CLASS_OTHER     8u  // SEI, access unit delimiters, filler, ...
+#define NAL_CLASS_ALL       15u
+
+/**
+*  NalIndex
+* @brief Type, offset and size of every NAL unit of the video samples, built in one walk.
+* @details The units come from the length-prefixed NAL walk over the sample table, in file order.
+*  Each unit keeps its nal_unit_type and a class (IDR, other slices, parameter sets, other),
+*  so parameter sets can be protected byte-exactly and stages can draw their positions from the
+*  units of the classes they target instead of from the whole window.
+* @author AXIS5 with assistance from LLM
+*/
+class NalIndex {
+public:
+    struct Unit {
+        uint64_t offset;    // first byte of the NAL header, behind the length prefix
+        uint32_t size;      // NAL unit size without the prefix
+        uint8_t type;       // nal_unit_type
+        uint8_t nal_class;  // NAL_CLASS_*
+        uint8_t prefix;     // length prefix size in front of offset
+    };
+
+    void clear() { vector<Unit>().swap(list); }
+    void reserve(size_t n) { list.reserve(n); }
+
+    //add a unit whose header byte is header (the first header byte, H.265 has two)
+    void add(uint64_t offset, uint32_t size, uint8_t header, bool hevc, uint8_t prefix) {
+        uint8_t type = hevc ? uint8_t((header >> 1) & 0x3F) : uint8_t(header & 0x1F);
+        list.push_back({ offset, size, type, classify(type, hevc), prefix });
+    }
+    void add(const Unit& unit) { list.push_back(unit); }
+
+    //sort by offset, units of several tracks interleave in the file
+    void sort();
+
+    bool empty() const { return list.empty(); }
+    size_t size() const { return list.size(); }
+    const vector<Unit>& units() const { return list; }
+
+    //first unit whose offset is at or after pos
+    size_t lowerBound(uint64_t pos) const;
+
+    //units of the classes in mask
+    size_t count(unsigned mask) const;
+
+    static uint8_t classify(uint8_t type, bool hevc);
+
+    //"idr", "slices", "params", "other" or "all", comma separated; 0 if a name is unknown
+    static unsigned parseClasses(const string& names);
+
+    //inverse of parseClasses
+    static string classNames(unsigned mask);
+
+private:
+    vector<Unit> list;
+};
+
+#endif // !NALINDEX_H
@@ -0,0 +1,29 @@
+// PositionSampler.cpp
+#include "PositionSampler.h"
+#include <algorithm>
+
+using namespace std;
+
+void PositionSampler::addWindow(size_t begin, size_t end) {
+    size_t pos = begin;
+    size_t i = prot.lowerBound(begin);
+    while (pos < end) {
+        size_t gap_end = end;
+        if (i < prot.size() && prot[i].begin < end) {
+            gap_end = max(pos, prot[i].begin);
+        }
+        if (gap_end > pos) {
+            seg_begin.push_back(pos);
+            prefix.push_back(prefix.back() + (gap_end - pos));
+        }
+        if (i >= prot.size() || prot[i].begin >= end) break;
+        pos = prot[i].end;
+        i++;
+    }
+}
+
+size_t PositionSampler::at(size_t rank) const {
+    // first segment whose cumulative end is beyond rank
+    size_t seg = upper_bound(prefix.begin() + 1, prefix.end(), rank) - (prefix.begin() + 1);
+    return seg_begin[seg] + (rank - prefix[seg]);
+}
@@ -0,0 +1,93 @@
+// PositionSampler.h
+#ifndef POSITIONSAMPLER_H
+#define POSITIONSAMPLER_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include "RangeSet.h"
+
+using std::vector;
+
+/**
+*  PositionSampler
+* @brief Draws uniformly distributed unprotected byte positions from one or more windows.
+* @details The unprotected bytes of all windows are indexed by a prefix sum over their free
+*  segments. A draw picks a rank in [0, freeBytes()) and maps it back to a file offset with one
+*  binary search, so every draw succeeds in O(log R) no matter how densely the windows are
+*  protected. A window without free bytes yields no positions instead of looping forever.
+*  drawSorted generates the ranks already in ascending order (sequential order statistics) and
+*  maps them in one forward pass over the segments, for plans that are applied as a sweep.
+* @author AXIS5 with assistance from LLM
+*/
+class PositionSampler {
+public:
+    explicit PositionSampler(const RangeSet& protected_ranges) : prot(protected_ranges) {}
+
+    //add the unprotected bytes of [begin, end)
+    void addWindow(size_t begin, size_t end);
+
+    //number of unprotected bytes in all windows
+    size_t freeBytes() const { return prefix.back(); }
+
+    //offset of the rank-th unprotected byte (rank < freeBytes())
+    size_t at(size_t rank) const;
+
+    //draw one position; freeBytes() must not be 0
+    template<class URBG>
+    size_t draw(URBG& g) const {
+        std::uniform_int_distribution<size_t> rank_dist(0, freeBytes() - 1);
+        return at(rank_dist(g));
+    }
+
+    //draw exactly n positions (none if the windows are fully protected)
+    template<class URBG>
+    vector<size_t> drawMany(URBG& g, size_t n) const {
+        vector<size_t> positions;
+        if (freeBytes() == 0) return positions;
+        positions.reserve(n);
+        std::uniform_int_distribution<size_t> rank_dist(0, freeBytes() - 1);
+        for (size_t i = 0; i < n; i++) {
+            positions.push_back(at(rank_dist(g)));
+        }
+        return positions;
+    }
+
+    //draw exactly n positions in ascending order (address order if the windows were added in
+    //address order); the same distribution as drawMany, without sorting or searching
+    template<class URBG>
+    vector<size_t> drawSorted(URBG& g, size_t n) const {
+        vector<size_t> positions;
+        size_t total = freeBytes();
+        if (total == 0) return positions;
+        positions.reserve(n);
+        // the minimum of k uniforms on [x, total) is x + (total - x) * (1 - U^(1/k))
+        double x = 0;
+        size_t seg = 0;
+        for (size_t k = n; k > 0; k--) {
+            x += ((double)total - x) * -std::expm1(std::log(unit(g)) / (double)k);
+            size_t rank = std::min((size_t)x, total - 1);
+            while (prefix[seg + 1] <= rank) seg++;
+            positions.push_back(seg_begin[seg] + (rank - prefix[seg]));
+        }
+        return positions;
+    }
+
+private:
+    // uniform in (0, 1] from 53 bits of two 32-bit draws, drawn in a fixed order
+    template<class URBG>
+    static double unit(URBG& g) {
+        uint64_t hi = (uint64_t)(g() & 0xFFFFFFFFu);
+        uint64_t lo = (uint64_t)(g() & 0xFFFFFFFFu);
+        return (double((((hi << 32) | lo) >> 11) + 1)) * (1.0 / 9007199254740992.0);
+    }
+
+    const RangeSet& prot;
+    vector<size_t> seg_begin;           // start offset of each free segment
+    vector<size_t> prefix = { 0 };      // free bytes before segment i
+};
+
+#endif // !POSITIONSAMPLER_H
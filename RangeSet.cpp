@@ -0,0 +1,90 @@
+// RangeSet.cpp
+#include "RangeSet.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+void RangeSet::add(size_t begin, size_t end) {
+    if (begin >= end) return;
+    if (!ranges.empty() && sorted) {
+        Range& last = ranges.back();
+        if (begin >= last.begin) {
+            // in-order append: extend the last range or start a new one
+            if (begin <= last.end) {
+                last.end = max(last.end, end);
+                return;
+            }
+        }
+        else {
+            sorted = false;
+        }
+    }
+    ranges.push_back({ begin, end });
+}
+
+void RangeSet::merge(const RangeSet& other) {
+    for (const Range& r : other.ranges) {
+        add(r.begin, r.end);
+    }
+}
+
+void RangeSet::normalize() {
+    if (sorted) return;
+    sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+        return a.begin < b.begin;
+    });
+    size_t out = 0;
+    for (size_t i = 1; i < ranges.size(); i++) {
+        if (ranges[i].begin <= ranges[out].end) {
+            ranges[out].end = max(ranges[out].end, ranges[i].end);
+        }
+        else {
+            ranges[++out] = ranges[i];
+        }
+    }
+    ranges.resize(ranges.empty() ? 0 : out + 1);
+    sorted = true;
+}
+
+void RangeSet::clear() {
+    ranges.clear();
+    sorted = true;
+}
+
+size_t RangeSet::lowerBound(size_t pos) const {
+    return upper_bound(ranges.begin(), ranges.end(), pos, [](size_t p, const Range& r) {
+        return p < r.end;
+    }) - ranges.begin();
+}
+
+bool RangeSet::contains(size_t pos) const {
+    size_t i = lowerBound(pos);
+    return i < ranges.size() && ranges[i].begin <= pos;
+}
+
+size_t RangeSet::distanceToNext(size_t pos) const {
+    size_t i = lowerBound(pos);
+    if (i == ranges.size()) return numeric_limits<size_t>::max();
+    return ranges[i].begin <= pos ? 0 : ranges[i].begin - pos;
+}
+
+size_t RangeSet::nextUncovered(size_t pos) const {
+    size_t i = lowerBound(pos);
+    if (i < ranges.size() && ranges[i].begin <= pos) return ranges[i].end;
+    return pos;
+}
+
+size_t RangeSet::coveredBytes() const {
+    size_t total = 0;
+    for (const Range& r : ranges) total += r.end - r.begin;
+    return total;
+}
+
+size_t RangeSet::coveredBytes(size_t begin, size_t end) const {
+    size_t total = 0;
+    for (size_t i = lowerBound(begin); i < ranges.size() && ranges[i].begin < end; i++) {
+        total += min(ranges[i].end, end) - max(ranges[i].begin, begin);
+    }
+    return total;
+}
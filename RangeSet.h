@@ -0,0 +1,67 @@
+// RangeSet.h
+#ifndef RANGESET_H
+#define RANGESET_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+
+/**
+*  RangeSet
+* @brief A sorted set of disjoint half-open byte ranges [begin, end).
+* @details Ranges are appended with add() and merged by normalize(); appending in ascending
+*  order (the usual case when walking a file) stays O(1) per range. Queries binary-search the
+*  merged ranges, so memory and lookup cost depend on the number of regions, not on file size.
+*  Queries are only valid after normalize().
+* @author AXIS5 with assistance from LLM
+*/
+class RangeSet {
+public:
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+
+    //add [begin, end); empty ranges are ignored
+    void add(size_t begin, size_t end);
+
+    //add all ranges of another set
+    void merge(const RangeSet& other);
+
+    //sort and merge overlapping/adjacent ranges
+    void normalize();
+
+    void clear();
+
+    //is pos inside any range
+    bool contains(size_t pos) const;
+
+    //bytes from pos to the next covered byte (0 if pos is covered, SIZE_MAX if none follows)
+    size_t distanceToNext(size_t pos) const;
+
+    //first uncovered byte at or after pos
+    size_t nextUncovered(size_t pos) const;
+
+    //number of covered bytes
+    size_t coveredBytes() const;
+
+    //number of covered bytes inside [begin, end)
+    size_t coveredBytes(size_t begin, size_t end) const;
+
+    bool empty() const { return ranges.empty(); }
+    size_t size() const { return ranges.size(); }
+    const Range& operator[](size_t i) const { return ranges[i]; }
+    vector<Range>::const_iterator begin() const { return ranges.begin(); }
+    vector<Range>::const_iterator end() const { return ranges.end(); }
+
+    //index of the first range whose end is after pos
+    size_t lowerBound(size_t pos) const;
+
+private:
+    vector<Range> ranges;
+    bool sorted = true;
+};
+
+#endif // !RANGESET_H
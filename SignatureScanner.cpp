@@ -0,0 +1,234 @@
+// SignatureScanner.cpp
+#include "SignatureScanner.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCANNER_HAS_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__GNUC__)
+#define SCANNER_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SCANNER_HAS_AVX2) && defined(__GNUC__)
+#define SCANNER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SCANNER_TARGET_AVX2
+#endif
+
+using namespace std;
+
+namespace {
+    bool cpuHasAVX2() {
+#if defined(SCANNER_HAS_AVX2) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif defined(SCANNER_HAS_AVX2) && defined(__GNUC__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    const bool use_avx2 = cpuHasAVX2();
+
+    inline unsigned countTrailingZeros(uint32_t v) {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, v);
+        return idx;
+#else
+        return (unsigned)__builtin_ctz(v);
+#endif
+    }
+}
+
+void SignatureScanner::addPattern(uint32_t type, const char* bytes, size_t len) {
+    uint8_t values[SCANNER_MAX_PATTERN_LENGTH];
+    uint8_t masks[SCANNER_MAX_PATTERN_LENGTH];
+    for (size_t i = 0; i < len && i < SCANNER_MAX_PATTERN_LENGTH; i++) {
+        values[i] = static_cast<uint8_t>(bytes[i]);
+        masks[i] = 0xFF;
+    }
+    addPattern(type, values, masks, len);
+}
+
+void SignatureScanner::addPattern(uint32_t type, const uint8_t* values, const uint8_t* masks, size_t len) {
+    if (len < 2 || len > SCANNER_MAX_PATTERN_LENGTH || patterns.size() >= SCANNER_MAX_PATTERNS) {
+        throw invalid_argument("SignatureScanner: unsupported pattern");
+    }
+    Pattern p;
+    p.type = type;
+    p.len = static_cast<uint8_t>(len);
+    for (size_t i = 0; i < len; i++) {
+        p.mask[i] = masks[i];
+        p.value[i] = values[i] & masks[i];
+    }
+    patterns.push_back(p);
+
+    Filter f = { p.value[0], p.mask[0], p.value[1], p.mask[1] };
+    for (const Filter& g : filters) {
+        if (g.v0 == f.v0 && g.m0 == f.m0 && g.v1 == f.v1 && g.m1 == f.m1) return;
+    }
+    filters.push_back(f);
+}
+
+const char* SignatureScanner::engineName() {
+#if defined(SCANNER_HAS_SSE2)
+    return use_avx2 ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// check every pattern at a candidate offset, in registration order
+inline void SignatureScanner::verify(const uint8_t* data, size_t size, size_t pos, vector<Hit>& hits) const {
+    size_t first_hit = hits.size();
+    for (const Pattern& p : patterns) {
+        if (pos + p.len > size) continue;
+        bool match = true;
+        for (size_t k = 0; k < p.len; k++) {
+            if ((data[pos + k] & p.mask[k]) != p.value[k]) {
+                match = false;
+                break;
+            }
+        }
+        if (!match) continue;
+        // one hit per (offset, type)
+        bool seen = false;
+        for (size_t h = first_hit; h < hits.size(); h++) {
+            if (hits[h].type == p.type) {
+                seen = true;
+                break;
+            }
+        }
+        if (!seen) hits.push_back({ pos, p.type });
+    }
+}
+
+void SignatureScanner::scanScalar(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const {
+    for (size_t i = begin; i < end && i + 1 < size; i++) {
+        for (const Filter& f : filters) {
+            if ((data[i] & f.m0) == f.v0 && (data[i + 1] & f.m1) == f.v1) {
+                verify(data, size, i, hits);
+                break;
+            }
+        }
+    }
+}
+
+// returns the first offset that was not covered by full vectors
+size_t SignatureScanner::scanSSE2(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const {
+    size_t i = begin;
+#if defined(SCANNER_HAS_SSE2)
+    // a block at i reads data[i, i+17)
+    size_t limit = min(end, size > 16 ? size - 16 : 0);
+    const size_t nf = filters.size();
+    __m128i v0[SCANNER_MAX_PATTERNS], m0[SCANNER_MAX_PATTERNS], v1[SCANNER_MAX_PATTERNS], m1[SCANNER_MAX_PATTERNS];
+    for (size_t f = 0; f < nf; f++) {
+        v0[f] = _mm_set1_epi8((char)filters[f].v0);
+        m0[f] = _mm_set1_epi8((char)filters[f].m0);
+        v1[f] = _mm_set1_epi8((char)filters[f].v1);
+        m1[f] = _mm_set1_epi8((char)filters[f].m1);
+    }
+    for (; i < limit; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i acc = _mm_setzero_si128();
+        for (size_t f = 0; f < nf; f++) {
+            __m128i e0 = _mm_cmpeq_epi8(_mm_and_si128(a, m0[f]), v0[f]);
+            __m128i e1 = _mm_cmpeq_epi8(_mm_and_si128(b, m1[f]), v1[f]);
+            acc = _mm_or_si128(acc, _mm_and_si128(e0, e1));
+        }
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(acc);
+        if (i + 16 > end) bits &= (1u << (end - i)) - 1;
+        while (bits) {
+            verify(data, size, i + countTrailingZeros(bits), hits);
+            bits &= bits - 1;
+        }
+    }
+#endif
+    return i;
+}
+
+SCANNER_TARGET_AVX2
+size_t SignatureScanner::scanAVX2(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const {
+    size_t i = begin;
+#if defined(SCANNER_HAS_AVX2)
+    // a block at i reads data[i, i+33)
+    size_t limit = min(end, size > 32 ? size - 32 : 0);
+    const size_t nf = filters.size();
+    __m256i v0[SCANNER_MAX_PATTERNS], m0[SCANNER_MAX_PATTERNS], v1[SCANNER_MAX_PATTERNS], m1[SCANNER_MAX_PATTERNS];
+    for (size_t f = 0; f < nf; f++) {
+        v0[f] = _mm256_set1_epi8((char)filters[f].v0);
+        m0[f] = _mm256_set1_epi8((char)filters[f].m0);
+        v1[f] = _mm256_set1_epi8((char)filters[f].v1);
+        m1[f] = _mm256_set1_epi8((char)filters[f].m1);
+    }
+    for (; i < limit; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t f = 0; f < nf; f++) {
+            __m256i e0 = _mm256_cmpeq_epi8(_mm256_and_si256(a, m0[f]), v0[f]);
+            __m256i e1 = _mm256_cmpeq_epi8(_mm256_and_si256(b, m1[f]), v1[f]);
+            acc = _mm256_or_si256(acc, _mm256_and_si256(e0, e1));
+        }
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(acc);
+        if (i + 32 > end) bits &= (1u << (end - i)) - 1;
+        while (bits) {
+            verify(data, size, i + countTrailingZeros(bits), hits);
+            bits &= bits - 1;
+        }
+    }
+#endif
+    return i;
+}
+
+vector<SignatureScanner::Hit> SignatureScanner::scan(const uint8_t* data, size_t size, size_t begin, size_t end) const {
+    vector<Hit> hits;
+    end = min(end, size);
+    if (patterns.empty() || begin >= end) return hits;
+
+    size_t i = begin;
+    if (use_avx2) {
+        i = scanAVX2(data, size, i, end, hits);
+    }
+    i = scanSSE2(data, size, i, end, hits);
+    scanScalar(data, size, i, end, hits);
+    return hits;
+}
+
+vector<SignatureScanner::Hit> SignatureScanner::scan(ThreadPool& pool, const uint8_t* data, size_t size, size_t begin, size_t end) const {
+    end = min(end, size);
+    if (begin >= end || pool.size() == 1) return scan(data, size, begin, end);
+    size_t len = end - begin;
+    size_t chunks = min(pool.size() * SCANNER_TASKS_PER_THREAD, (len + SCANNER_PARALLEL_CHUNK - 1) / SCANNER_PARALLEL_CHUNK);
+    if (chunks <= 1) return scan(data, size, begin, end);
+
+    // a pattern crossing a chunk end is verified against data[0, size) by the chunk it starts
+    // in, so each hit is found exactly once and the parts are in address order
+    size_t step = (len + chunks - 1) / chunks;
+    vector<vector<Hit>> parts(chunks);
+    pool.parallelFor(chunks, [&](size_t c) {
+        size_t chunk_begin = begin + c * step;
+        size_t chunk_end = min(end, chunk_begin + step);
+        if (chunk_begin < chunk_end) parts[c] = scan(data, size, chunk_begin, chunk_end);
+    });
+    size_t total = 0;
+    for (const auto& part : parts) total += part.size();
+    vector<Hit> hits;
+    hits.reserve(total);
+    for (const auto& part : parts) hits.insert(hits.end(), part.begin(), part.end());
+    return hits;
+}
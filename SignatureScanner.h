@@ -0,0 +1,79 @@
+// SignatureScanner.h
+#ifndef SIGNATURESCANNER_H
+#define SIGNATURESCANNER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::vector;
+
+// longest pattern the scanner accepts
+#define SCANNER_MAX_PATTERN_LENGTH 8
+// most patterns one scanner can hold
+#define SCANNER_MAX_PATTERNS 32
+// smallest range a parallel scan hands to one task
+#define SCANNER_PARALLEL_CHUNK (4u << 20)
+// tasks per thread of a parallel scan, evens out chunks with many candidates
+#define SCANNER_TASKS_PER_THREAD 4
+
+class ThreadPool;
+
+/**
+*  SignatureScanner
+* @brief Finds any number of short byte signatures in a single pass over a buffer.
+* @details Every pattern is a list of (value, mask) bytes, so "one of 0/1" or "0xFF then 0xEx"
+*  can be expressed directly. The first two bytes of all patterns are tested together with
+*  SSE2 or AVX2 (picked at runtime, scalar fallback elsewhere); only candidate offsets are
+*  verified byte by byte. Hits come out sorted by offset and tagged with the caller's type id.
+*  A range can also be scanned on a thread pool: every chunk reports only the hits that start
+*  inside it, verified against the whole buffer, so the chunk results simply concatenate.
+* @author AXIS5 with assistance from LLM
+*/
+class SignatureScanner {
+public:
+    struct Hit {
+        uint64_t offset;    // offset of the first pattern byte
+        uint32_t type;      // type id given to addPattern
+    };
+
+    //register an exact pattern (at least 2 bytes)
+    void addPattern(uint32_t type, const char* bytes, size_t len);
+
+    //register a masked pattern: byte i matches when (data & masks[i]) == values[i]
+    void addPattern(uint32_t type, const uint8_t* values, const uint8_t* masks, size_t len);
+
+    //scan data[begin, end) for all patterns; a hit is reported only if the whole pattern fits in data[0, size)
+    vector<Hit> scan(const uint8_t* data, size_t size, size_t begin, size_t end) const;
+
+    //scan the whole buffer
+    vector<Hit> scan(const uint8_t* data, size_t size) const { return scan(data, size, 0, size); }
+
+    //scan(data, size, begin, end) split into address-ordered chunks run on pool; same hits
+    vector<Hit> scan(ThreadPool& pool, const uint8_t* data, size_t size, size_t begin, size_t end) const;
+
+    //name of the vector path scan() will use ("avx2", "sse2" or "scalar")
+    static const char* engineName();
+
+private:
+    struct Pattern {
+        uint32_t type;
+        uint8_t len;
+        uint8_t value[SCANNER_MAX_PATTERN_LENGTH];
+        uint8_t mask[SCANNER_MAX_PATTERN_LENGTH];
+    };
+    // distinct (first byte, second byte) tests shared by the patterns
+    struct Filter {
+        uint8_t v0, m0, v1, m1;
+    };
+
+    vector<Pattern> patterns;
+    vector<Filter> filters;
+
+    void verify(const uint8_t* data, size_t size, size_t pos, vector<Hit>& hits) const;
+    void scanScalar(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const;
+    size_t scanSSE2(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const;
+    size_t scanAVX2(const uint8_t* data, size_t size, size_t begin, size_t end, vector<Hit>& hits) const;
+};
+
+#endif // !SIGNATURESCANNER_H
@@ -0,0 +1,436 @@
+// StreamCorruptor.cpp
+#include "StreamCorruptor.h"
+#include "AVICorruptor.h"
+#include "MP4Corruptor.h"
+#include "AVIRiffParser.h"
+#include "MP4BoxParser.h"
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+    // RIFF AVI: hdrl for the frame count, then the chunks of the first movi list
+    class AVIStreamWalker : public StreamWalker {
+    public:
+        uint64_t advance(const uint8_t* data, uint64_t base, size_t size, bool eof, bool stalled,
+            vector<RangeSet::Range>& prot, vector<Payload>& payloads) override {
+            uint64_t view_end = base + size;
+            while (state != DONE) {
+                // behind a movi list: idx1, then the RIFF AVIX segments of an OpenDML file
+                if (state == MOVI && next >= movi_end) state = HEAD;
+                // the next header is not in the view yet
+                if (next + 12 > view_end) {
+                    if (eof || stalled) state = DONE;
+                    break;
+                }
+                const uint8_t* p = data + (next - base);
+                uint32_t id = AVIRiffParser::readU32(p);
+                uint32_t chunk_size = AVIRiffParser::readU32(p + 4);
+                uint64_t chunk_end = next + 8 + (uint64_t)chunk_size + (chunk_size & 1);
+
+                if (state == RIFF) {
+                    if (id != AVI_FOURCC('R', 'I', 'F', 'F') || AVIRiffParser::readU32(p + 8) != AVI_FOURCC('A', 'V', 'I', ' ')) {
+                        state = DONE;
+                        break;
+                    }
+                    state = HEAD;
+                    next += 12;
+                }
+                else if (state == HEAD) {
+                    if (id == AVI_FOURCC('R', 'I', 'F', 'F')) {
+                        if (AVIRiffParser::readU32(p + 8) != AVI_FOURCC('A', 'V', 'I', 'X')) {
+                            state = DONE;
+                            break;
+                        }
+                        next += 12;
+                    }
+                    else if (id == AVI_FOURCC('L', 'I', 'S', 'T')) {
+                        if (AVIRiffParser::readU32(p + 8) == AVI_FOURCC('m', 'o', 'v', 'i')) {
+                            movi_end = next + 8 + (uint64_t)chunk_size;
+                            // dwTotalFrames counts the first segment, later ones get as many frames per byte
+                            uint64_t length = movi_end - (next + 12);
+                            uint64_t movi_frames = frames;
+                            if (payloads_seen == 0) first_movi = length;
+                            else if (first_movi) movi_frames = (uint64_t)((double)frames * (double)length / (double)first_movi + 0.5);
+                            payloads.push_back({ next + 12, movi_end, movi_frames, false });
+                            payloads_seen++;
+                            state = MOVI;
+                        }
+                        // step into hdrl/strl/odml and the movi list
+                        next += 12;
+                    }
+                    else {
+                        if (id == AVI_FOURCC('a', 'v', 'i', 'h') && frames == 0) {
+                            // dwTotalFrames is the fifth field of the main header
+                            if (next + 8 + 20 > view_end) {
+                                if (!eof && !stalled) break;
+                            }
+                            else {
+                                frames = AVIRiffParser::readU32(p + 8 + 16);
+                            }
+                        }
+                        next = chunk_end;
+                    }
+                }
+                else {
+                    if (id == AVI_FOURCC('L', 'I', 'S', 'T')) {
+                        // 'rec ' group
+                        prot.push_back({ (size_t)next, (size_t)(next + 12) });
+                        next += 12;
+                    }
+                    else if (AVIRiffParser::isStreamChunk(id)) {
+                        prot.push_back({ (size_t)next, (size_t)min<uint64_t>(next + AVI_FRAME_HEADER_SIZE, chunk_end) });
+                        next = chunk_end;
+                    }
+                    else {
+                        // ix##, JUNK, ...: keep it whole
+                        prot.push_back({ (size_t)next, (size_t)chunk_end });
+                        next = chunk_end;
+                    }
+                }
+            }
+            return state == DONE ? UINT64_MAX : next;
+        }
+
+    private:
+        enum { RIFF, HEAD, MOVI, DONE } state = RIFF;
+        uint64_t next = 0;
+        uint64_t movi_end = 0;
+        uint64_t frames = 0;
+        uint64_t first_movi = 0;        // payload bytes of the first movi list
+        uint64_t payloads_seen = 0;
+    };
+
+    // ISO-BMFF: top-level boxes in order, sample tables from a moov in front of the mdat and,
+    // in a fragmented file, from the moof in front of every mdat
+    class MP4StreamWalker : public StreamWalker {
+    public:
+        explicit MP4StreamWalker(std::ostream*& log) : log(log) {}
+
+        uint64_t advance(const uint8_t* data, uint64_t base, size_t size, bool eof, bool stalled,
+            vector<RangeSet::Range>& prot, vector<Payload>& payloads) override {
+            view_end = base + size;
+            while (!done) {
+                wanted = next + 8;
+                if (next + 8 > view_end) {
+                    if (eof || stalled) done = true;
+                    break;
+                }
+                const uint8_t* p = data + (next - base);
+                uint64_t box_size = MP4BoxParser::readU32(p);
+                uint32_t type = MP4BoxParser::readU32(p + 4);
+                uint32_t header = 8;
+                if (box_size == 1) {
+                    wanted = next + 16;
+                    if (next + 16 > view_end) {
+                        if (eof || stalled) done = true;
+                        break;
+                    }
+                    box_size = MP4BoxParser::readU64(p + 8);
+                    header = 16;
+                }
+                if (box_size == 0 && type == MP4_FOURCC('m', 'd', 'a', 't')) {
+                    *log << "mdat runs to the end of the stream, its size is unknown - nothing corrupted" << endl;
+                    done = true;
+                    break;
+                }
+                if (box_size < header) {
+                    done = true;
+                    break;
+                }
+                // a largesize that wraps the box end back below next would walk in a circle
+                if (box_size > UINT64_MAX - next) {
+                    *log << "box at " << next << " runs past any possible stream end, walk stopped" << endl;
+                    done = true;
+                    break;
+                }
+
+                if (type == MP4_FOURCC('m', 'd', 'a', 't')) {
+                    Payload payload = { next + header, next + box_size, framesIn(next + header, next + box_size), fragment };
+                    if (payload.frames == 0 && !warned) {
+                        *log << "no sample table in front of the mdat, sample headers cannot be protected while streaming" << endl;
+                        warned = true;
+                    }
+                    payloads.push_back(payload);
+                }
+                else if ((type == MP4_FOURCC('m', 'o', 'o', 'v') && !has_moov) || type == MP4_FOURCC('m', 'o', 'o', 'f')) {
+                    if (next + box_size > view_end) {
+                        wanted = next + box_size;
+                        if (!stalled && !eof) break;
+                        *log << (type == MP4_FOURCC('m', 'o', 'o', 'v') ? "moov" : "moof")
+                            << " is larger than the stream window, sample headers not protected" << endl;
+                    }
+                    else if (type == MP4_FOURCC('m', 'o', 'o', 'v')) {
+                        // the file size is not known yet, samples are checked against the mdat later
+                        has_moov = true;
+                        if (parser.parse(p, (size_t)box_size, UINT64_MAX)) addSamples(prot);
+                    }
+                    else if (parser.parseFragment(p, (size_t)box_size, next)) {
+                        fragment = true;
+                        addSamples(prot);
+                        // the next fragment brings its own samples
+                        parser.clearSamples();
+                    }
+                }
+                next += box_size;
+            }
+            return done ? UINT64_MAX : next;
+        }
+
+        uint64_t need() const override {
+            if (done) return UINT64_MAX;
+            // the body of the current box streams by: read up to its end, then the next header
+            return next > view_end ? next : wanted;
+        }
+
+    private:
+        std::ostream*& log;
+        MP4BoxParser parser;            // keeps tracks and trex defaults of the moov for the fragments
+        vector<uint64_t> sample_starts; // ascending, ahead of next
+        uint64_t next = 0;
+        uint64_t wanted = 8;
+        uint64_t view_end = 0;
+        bool done = false;
+        bool has_moov = false;
+        bool warned = false;
+        bool fragment = false;          // a moof was seen, every mdat is a fragment
+
+        uint64_t framesIn(uint64_t begin, uint64_t end) const {
+            return (uint64_t)(lower_bound(sample_starts.begin(), sample_starts.end(), end) -
+                lower_bound(sample_starts.begin(), sample_starts.end(), begin));
+        }
+
+        // protect the headers of the samples the parser resolved; the ones behind us streamed by already
+        void addSamples(vector<RangeSet::Range>& prot) {
+            vector<RangeSet::Range> ranges;
+            for (const auto& track : parser.getTracks()) {
+                size_t protect = 0;
+                // handler 0: a fragment whose moov was not part of the stream
+                if (track.handler == MP4_FOURCC('v', 'i', 'd', 'e') || track.handler == 0) protect = MP4_FRAME_HEADER_PROTECT_SIZE;
+                else if (track.handler == MP4_FOURCC('s', 'o', 'u', 'n')) protect = MP4_AUDIO_FRAME_HEADER_PROTECT_SIZE;
+                else continue;
+                for (const auto& sample : track.samples) {
+                    if (sample.offset < next) continue;
+                    ranges.push_back({ (size_t)sample.offset, (size_t)(sample.offset + protect) });
+                }
+            }
+            sort(ranges.begin(), ranges.end(), [](const RangeSet::Range& a, const RangeSet::Range& b) {
+                return a.begin < b.begin;
+            });
+            prot.insert(prot.end(), ranges.begin(), ranges.end());
+
+            sample_starts.erase(sample_starts.begin(), lower_bound(sample_starts.begin(), sample_starts.end(), next));
+            size_t old_count = sample_starts.size();
+            for (const auto& r : ranges) sample_starts.push_back(r.begin);
+            inplace_merge(sample_starts.begin(), sample_starts.begin() + old_count, sample_starts.end());
+        }
+    };
+}
+
+StreamCorruptor::StreamCorruptor(const string& format) {
+    string fmt = format;
+    transform(fmt.begin(), fmt.end(), fmt.begin(), (int (*)(int))tolower);
+    if (fmt == "avi") {
+        corruptor.reset(new AVICorruptor());
+        walker.reset(new AVIStreamWalker());
+    }
+    else if (fmt == "mp4") {
+        corruptor.reset(new MP4Corruptor());
+        walker.reset(new MP4StreamWalker(log_stream));
+    }
+    if (corruptor) corruptor->setLog(log_stream);
+}
+
+StreamCorruptor::~StreamCorruptor() = default;
+
+void StreamCorruptor::startStages(const StreamWalker::Payload& payload, uint64_t index) {
+    corruptor->frmcount = payload.frames;
+    uint64_t length = payload.end > payload.begin ? payload.end - payload.begin : 0;
+    *log_stream << "Payload " << (index + 1) << ": " << payload.begin << " - " << payload.end << ", "
+        << payload.frames << " frames" << endl;
+
+    cursors.assign(corruptor->stages.size(), StageCursor());
+    carry.resize(cursors.size(), 0.0);
+    for (size_t s = 0; s < cursors.size(); s++) {
+        const auto& stage = corruptor->stages[s];
+        StageCursor& c = cursors[s];
+        c.begin = payload.begin + (uint64_t)(stage.start_ratio * length);
+        c.end = payload.begin + (uint64_t)(stage.end_ratio * length);
+        if (payload.fragment) {
+            double exact = (double)payload.frames * stage.intensity + carry[s];
+            c.total = (uint64_t)exact;
+            carry[s] = exact - (double)c.total;
+            if (c.end <= c.begin) c.total = 0;
+        }
+        else {
+            c.total = c.end > c.begin ? corruptor->stageGlitches(stage) : 0;
+        }
+        c.x = (double)c.begin;
+        // every payload draws from its own streams
+        c.rng = GlitchRandom(corruptor->seed, STREAM_POSITION_STREAM + (index << 16) + s).getState();
+        // the schedule of a fragment repeats for every fragment, print it once
+        if (index == 0) {
+            *log_stream << "Stage " << (s + 1) << ": " << c.begin << " - " << c.end
+                << ", target " << c.total << " glitches" << endl;
+        }
+        advanceCursor(c, s);
+    }
+}
+
+void StreamCorruptor::advanceCursor(StageCursor& c, size_t) {
+    if (c.drawn >= c.total) {
+        c.next = UINT64_MAX;
+        return;
+    }
+    // next of the remaining (total - drawn) sorted uniform points: the minimum of
+    // k uniforms on [x, end) is x + (end - x) * (1 - U^(1/k))
+    GlitchRandom r(c.rng);
+    double u = ((r.next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    c.x += ((double)c.end - c.x) * (1.0 - pow(u, 1.0 / (double)(c.total - c.drawn)));
+    c.rng = r.getState();
+    c.drawn++;
+    c.next = min<uint64_t>((uint64_t)c.x, c.end - 1);
+}
+
+bool StreamCorruptor::run(std::istream& in, std::ostream& out) {
+    if (!valid()) return false;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    *log_stream << "Streaming with a " << window << " byte window, seed " << corruptor->seed << endl;
+
+    vector<uint8_t> buf(window + STREAM_LOOKBACK);
+    size_t filled = 0;
+    uint64_t base = 0;          // stream offset of buf[0], always even (noise works on offset parity)
+    uint64_t emitted = 0;       // everything before this is written out
+    bool eof = false;
+    bool stalled = false;
+    vector<RangeSet::Range> prot;
+    size_t prot_head = 0;
+    vector<StreamWalker::Payload> payloads;
+    size_t payload_head = 0;            // first payload not streamed by completely
+    uint64_t payloads_dropped = 0;      // finished payloads erased from the front
+    size_t active = SIZE_MAX;           // payload the cursors belong to
+    uint64_t glitch_seq = 0;
+    uint64_t glitch_total = 0;
+
+    for (;;) {
+        // read what the walker needs for its next step, a complete fragment goes out without
+        // waiting for the window to fill
+        while (!eof && filled < buf.size()) {
+            uint64_t want = walker->need();
+            size_t space = buf.size() - filled;
+            size_t amount = want > base + filled ? (size_t)min<uint64_t>(want - (base + filled), space) : space;
+            in.read(reinterpret_cast<char*>(buf.data() + filled), amount);
+            size_t got = (size_t)in.gcount();
+            filled += got;
+            if (got == 0 || !in) eof = true;
+            if (base + filled >= want) break;
+        }
+
+        uint64_t avail = base + filled;
+        uint64_t settled = walker->advance(buf.data(), base, filled, eof, stalled, prot, payloads);
+        uint64_t region_end = min(settled, avail);
+        if (region_end <= emitted) {
+            if (!eof && filled < buf.size()) continue;
+            if (!eof && !stalled) {
+                // the buffer is full and the walker waits for more: let it skip
+                stalled = true;
+                continue;
+            }
+            region_end = avail;
+        }
+        stalled = false;
+
+        // protection of the region, relative to buf: lookback, everything outside the payloads,
+        // and the structures inside them
+        size_t rel_begin = (size_t)(emitted - base);
+        size_t rel_end = (size_t)(region_end - base);
+        RangeSet& pr = corruptor->protected_ranges;
+        pr.clear();
+        pr.add(0, rel_begin);
+        uint64_t gap = emitted;
+        for (size_t i = payload_head; i < payloads.size() && payloads[i].begin < region_end; i++) {
+            if (payloads[i].begin > gap) pr.add((size_t)(gap - base), (size_t)(payloads[i].begin - base));
+            gap = max(gap, payloads[i].end);
+        }
+        if (gap < region_end) pr.add((size_t)(gap - base), rel_end);
+        while (prot_head < prot.size() && prot[prot_head].end <= emitted) prot_head++;
+        for (size_t i = prot_head; i < prot.size() && prot[i].begin < region_end; i++) {
+            if (prot[i].end <= emitted) continue;
+            pr.add((size_t)(max<uint64_t>(prot[i].begin, emitted) - base), (size_t)(min<uint64_t>(prot[i].end, region_end) - base));
+        }
+        pr.normalize();
+
+        // glitches whose positions fall into the region, bursts end with it
+        corruptor->file_data.borrow(buf.data(), rel_end);
+        vector<VideoCorruptor::Glitch> plan;
+        for (size_t i = payload_head; i < payloads.size() && payloads[i].begin < region_end; i++) {
+            if (i != active) {
+                startStages(payloads[i], payloads_dropped + i);
+                active = i;
+            }
+            // the cursors are sorted already: take the lowest one each time, the plan is one forward sweep
+            for (;;) {
+                size_t s = SIZE_MAX;
+                uint64_t lowest = region_end;
+                for (size_t k = 0; k < cursors.size(); k++) {
+                    if (cursors[k].next < lowest) {
+                        lowest = cursors[k].next;
+                        s = k;
+                    }
+                }
+                if (s == SIZE_MAX) break;
+                StageCursor& c = cursors[s];
+                size_t rel = (size_t)(c.next - base);
+                if (c.next >= emitted && pr.contains(rel)) rel = pr.nextUncovered(rel);
+                if (c.next >= emitted && rel < rel_end &&
+                    corruptor->addGlitch(plan, rel, corruptor->stages[s].burst_size, (int)s)) {
+                    plan.back().seq = glitch_seq++;
+                }
+                advanceCursor(c, s);
+            }
+        }
+        while (payload_head < payloads.size() && payloads[payload_head].end <= region_end) payload_head++;
+        corruptor->runGlitches(plan);
+        corruptor->file_data.reset();
+        glitch_total += plan.size();
+
+        out.write(reinterpret_cast<const char*>(buf.data() + rel_begin), rel_end - rel_begin);
+        out.flush();
+        if (!out) {
+            cerr << "Error writing output stream" << endl;
+            return false;
+        }
+        emitted = region_end;
+        if (eof && emitted == avail) break;
+
+        // slide: keep STREAM_LOOKBACK bytes of output behind the next region
+        uint64_t keep_from = emitted > STREAM_LOOKBACK ? (emitted - STREAM_LOOKBACK) & ~1ull : 0;
+        keep_from = max(keep_from, base);
+        size_t drop = (size_t)(keep_from - base);
+        if (drop > 0) {
+            memmove(buf.data(), buf.data() + drop, filled - drop);
+            filled -= drop;
+            base = keep_from;
+        }
+        if (prot_head > 4096 && prot_head * 2 > prot.size()) {
+            prot.erase(prot.begin(), prot.begin() + prot_head);
+            prot_head = 0;
+        }
+        if (payload_head > 1024 && payload_head * 2 > payloads.size()) {
+            payloads.erase(payloads.begin(), payloads.begin() + payload_head);
+            payloads_dropped += payload_head;
+            active = active >= payload_head && active != SIZE_MAX ? active - payload_head : SIZE_MAX;
+            payload_head = 0;
+        }
+    }
+    out.flush();
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    *log_stream << "Streamed " << emitted << " bytes, " << glitch_total << " glitches in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << "ms" << endl;
+    return true;
+}
@@ -0,0 +1,112 @@
+// StreamCorruptor.h
+#ifndef STREAMCORRUPTOR_H
+#define STREAMCORRUPTOR_H
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "VideoCorruptor.h"
+#include "RangeSet.h"
+
+using std::string;
+using std::vector;
+
+// default working window
+#define STREAM_DEFAULT_WINDOW (16u << 20)
+// output kept behind the current region, covers the 5000-55000 byte reach of copy-from-previous
+#define STREAM_LOOKBACK (64u << 10)
+// RNG streams of the position generators start here, far away from the glitch streams
+#define STREAM_POSITION_STREAM (1ull << 62)
+
+/**
+*  StreamWalker
+* @brief Forward, incremental parser of one container format for StreamCorruptor.
+* @details advance() sees a sliding view [base, base + size) of the input and walks the structures
+*  whose headers lie inside it. It appends every payload window (movi list, mdat of a fragment)
+*  with its frame count as soon as the header is read, appends protected ranges (absolute offsets,
+*  ascending) and returns the offset up to which protection is settled. With stalled set the view
+*  cannot grow any further and the walker has to move on without the structure it is waiting for.
+*  need() tells how far the input has to be read for the next step, so a fragment is passed on
+*  as soon as its last byte arrived instead of waiting for a full window.
+* @author AXIS5 with assistance from LLM
+*/
+class StreamWalker {
+public:
+    struct Payload {
+        uint64_t begin;
+        uint64_t end;
+        uint64_t frames;        // frame count for the stage schedule, 0 if unknown
+        bool fragment;          // one of many (moof + mdat), its glitch count is frames * intensity
+    };
+
+    virtual ~StreamWalker() = default;
+
+    virtual uint64_t advance(const uint8_t* data, uint64_t base, size_t size, bool eof, bool stalled,
+        vector<RangeSet::Range>& prot, vector<Payload>& payloads) = 0;
+
+    //stream offset the next step needs to have in view, UINT64_MAX = as much as the window holds
+    virtual uint64_t need() const { return UINT64_MAX; }
+};
+
+/**
+*  StreamCorruptor
+* @brief Corrupts a stream (stdin, a pipe, a file larger than RAM) in one forward pass with fixed memory.
+* @details The input is read into one buffer of window + STREAM_LOOKBACK bytes. Each region whose
+*  protection is settled by the walker is corrupted in place with the format corruptor's own glitch
+*  engine, written out and slid behind into the lookback, which copy-from-previous reads from.
+*  Stage windows are ratios of the payload size known from the container header (movi list, mdat),
+*  and the positions of each stage are generated in ascending order on the fly, so nothing grows
+*  with the input size except the sample table of a front moov. Every fragment of a fragmented
+*  MP4 is a payload of its own with its own stage schedule, corrupted and written out as soon as
+*  its mdat is complete; its glitch count is frames * intensity with the fractions carried to the
+*  next fragment, so the whole stream gets the density of the format's schedule and no per-file
+*  minimum is paid once per fragment.
+*  Bursts stop at region ends. An MP4 whose moov follows the mdat has no sample tables yet when
+*  the payload streams by, so only its box headers are protected.
+* @author AXIS5 with assistance from LLM
+*/
+class StreamCorruptor {
+public:
+    //"avi" or "mp4"
+    explicit StreamCorruptor(const string& format);
+    ~StreamCorruptor();
+
+    //false if the format is not supported
+    bool valid() const { return corruptor && walker; }
+
+    //working window in bytes (memory use is window + STREAM_LOOKBACK)
+    void setWindow(size_t bytes) { window = bytes < STREAM_LOOKBACK ? STREAM_LOOKBACK : bytes; }
+    void setSeed(uint64_t seed) { corruptor->setSeed(seed); }
+    uint64_t getSeed() const { return corruptor->getSeed(); }
+    void setThreads(size_t threads) { corruptor->setThreads(threads); }
+    void setLog(std::ostream* stream) { log_stream = stream; corruptor->setLog(stream); }
+
+    //corrupt in -> out
+    bool run(std::istream& in, std::ostream& out);
+
+private:
+    // ascending uniform positions of one stage
+    struct StageCursor {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        uint64_t total = 0;
+        uint64_t drawn = 0;
+        double x = 0;           // last position
+        uint64_t next = 0;      // pending position, UINT64_MAX when exhausted
+        uint64_t rng = 0;       // GlitchRandom state
+    };
+
+    std::unique_ptr<VideoCorruptor> corruptor;
+    std::unique_ptr<StreamWalker> walker;
+    size_t window = STREAM_DEFAULT_WINDOW;
+    std::ostream* log_stream = &std::cerr;
+    vector<StageCursor> cursors;
+    vector<double> carry;           // per stage: fractional glitches left over by previous fragments
+
+    void startStages(const StreamWalker::Payload& payload, uint64_t index);
+    void advanceCursor(StageCursor& c, size_t stage);
+};
+
+#endif // !STREAMCORRUPTOR_H
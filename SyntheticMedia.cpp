@@ -0,0 +1,696 @@
+// SyntheticMedia.cpp
+#include "SyntheticMedia.h"
+#include "GlitchRandom.h"
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    // fixed-size headers and tables, kept out of the frame budget
+    const uint64_t SYNTHETIC_HEADER_BUDGET = 4096;
+
+    // buffered output with the few primitives both containers need
+    class BlockWriter {
+    public:
+        BlockWriter(const string& filename, uint64_t seed) : out(filename, ios::binary | ios::trunc), rng(seed, 1) {
+            buf.reserve(SYNTHETIC_WRITE_BLOCK);
+        }
+
+        bool good() const { return (bool)out; }
+        uint64_t position() const { return written + buf.size(); }
+
+        void bytes(const void* p, size_t n) {
+            const uint8_t* b = static_cast<const uint8_t*>(p);
+            buf.insert(buf.end(), b, b + n);
+            if (buf.size() >= SYNTHETIC_WRITE_BLOCK) flush();
+        }
+        void bytes(const vector<uint8_t>& v) { bytes(v.data(), v.size()); }
+        void fourcc(const char* t) { bytes(t, 4); }
+        void le32(uint32_t v) {
+            uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) };
+            bytes(b, 4);
+        }
+        void be32(uint32_t v) {
+            uint8_t b[4] = { uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v) };
+            bytes(b, 4);
+        }
+        void be64(uint64_t v) {
+            be32(uint32_t(v >> 32));
+            be32(uint32_t(v));
+        }
+        void byte(uint8_t v) { bytes(&v, 1); }
+
+        // n random bytes straight into the buffer
+        void random(size_t n) {
+            while (n > 0) {
+                size_t room = SYNTHETIC_WRITE_BLOCK - min(buf.size(), (size_t)SYNTHETIC_WRITE_BLOCK);
+                if (room == 0) {
+                    flush();
+                    continue;
+                }
+                size_t k = min(n, room);
+                size_t at = buf.size();
+                buf.resize(at + k);
+                rng.fillBytes(buf.data() + at, k);
+                n -= k;
+                if (buf.size() >= SYNTHETIC_WRITE_BLOCK) flush();
+            }
+        }
+
+        bool finish() {
+            flush();
+            out.close();
+            return !out.fail();
+        }
+
+    private:
+        ofstream out;
+        GlitchRandom rng;
+        vector<uint8_t> buf;
+        uint64_t written = 0;
+
+        void flush() {
+            out.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+            written += buf.size();
+            buf.clear();
+        }
+    };
+
+    // in-memory big-endian box builder for the MP4 headers
+    class BoxBuilder {
+    public:
+        vector<uint8_t> data;
+
+        void be16(uint16_t v) { data.push_back(uint8_t(v >> 8)); data.push_back(uint8_t(v)); }
+        void be32(uint32_t v) { for (int i = 3; i >= 0; i--) data.push_back(uint8_t(v >> (8 * i))); }
+        void be64(uint64_t v) { be32(uint32_t(v >> 32)); be32(uint32_t(v)); }
+        void fourcc(const char* t) { data.insert(data.end(), t, t + 4); }
+        void zeros(size_t n) { data.insert(data.end(), n, 0); }
+        void bytes(const vector<uint8_t>& v) { data.insert(data.end(), v.begin(), v.end()); }
+
+        // open a box, returns its offset for close()
+        size_t open(const char* type) {
+            size_t at = data.size();
+            be32(0);
+            fourcc(type);
+            return at;
+        }
+        size_t openFull(const char* type, uint8_t version, uint32_t flags) {
+            size_t at = open(type);
+            be32((uint32_t(version) << 24) | flags);
+            return at;
+        }
+        void close(size_t at) { set32(at, uint32_t(data.size() - at)); }
+        // patch a field written before its value was known
+        void set32(size_t at, uint32_t v) {
+            for (int i = 0; i < 4; i++) data[at + i] = uint8_t(v >> (8 * (3 - i)));
+        }
+    };
+
+    // little-endian RIFF chunk builder for the AVI headers
+    class ChunkBuilder {
+    public:
+        vector<uint8_t> data;
+
+        void le16(uint16_t v) { data.push_back(uint8_t(v)); data.push_back(uint8_t(v >> 8)); }
+        void le32(uint32_t v) { for (int i = 0; i < 4; i++) data.push_back(uint8_t(v >> (8 * i))); }
+        void fourcc(const char* t) { for (int i = 0; i < 4; i++) data.push_back(uint8_t(t[i])); }
+        void zeros(size_t n) { data.insert(data.end(), n, 0); }
+
+        size_t open(const char* id) {
+            size_t at = data.size();
+            fourcc(id);
+            le32(0);
+            return at;
+        }
+        size_t openList(const char* type) {
+            size_t at = open("LIST");
+            fourcc(type);
+            return at;
+        }
+        void close(size_t at) {
+            uint32_t size = uint32_t(data.size() - at - 8);
+            set32(at + 4, size);
+            if (size & 1) data.push_back(0);
+        }
+        // patch a field written before its value was known
+        void set32(size_t at, uint32_t v) {
+            for (int i = 0; i < 4; i++) data[at + i] = uint8_t(v >> (8 * i));
+        }
+        void set64(size_t at, uint64_t v) {
+            set32(at, uint32_t(v));
+            set32(at + 4, uint32_t(v >> 32));
+        }
+    };
+}
+
+vector<uint32_t> SyntheticMedia::frameSizes(const Options& options, uint32_t per_frame_overhead) {
+    vector<uint32_t> sizes;
+    uint32_t mean = max<uint32_t>(options.frame_size, 64);
+    uint64_t budget = options.size > SYNTHETIC_HEADER_BUDGET ? options.size - SYNTHETIC_HEADER_BUDGET : 0;
+    GlitchRandom r(options.seed, 0);
+    uint64_t total = 0;
+    while (total < budget || sizes.empty()) {
+        uint32_t s = mean - mean / 4 + (uint32_t)r.below(mean / 2 + 1);
+        sizes.push_back(s);
+        total += s + per_frame_overhead;
+    }
+    return sizes;
+}
+
+bool SyntheticMedia::writeAVI(const string& filename, const Options& options) {
+    bool audio = options.audio_size > 0;
+    uint32_t audio_chunk = audio ? 8 + options.audio_size + (options.audio_size & 1) : 0;
+    vector<uint32_t> sizes = frameSizes(options, 8 + 1 + 16 + (audio ? audio_chunk + 16 : 0));
+    uint32_t frames = (uint32_t)sizes.size();
+    uint32_t max_frame = *max_element(sizes.begin(), sizes.end());
+    uint32_t streams = audio ? 2 : 1;
+
+    // frames of one movi list and where its pieces land in the file
+    struct Segment {
+        uint32_t first;
+        uint32_t count;
+        uint64_t chunk_bytes;   // 00dc/01wb chunks
+        uint64_t riff;          // RIFF header
+        uint64_t ix;            // first ix## chunk behind the stream chunks (OpenDML)
+        uint64_t movi_payload;
+        uint64_t riff_payload;
+    };
+    vector<Segment> segments(1, Segment{ 0, frames, 0, 0, 0, 0, 0 });
+    for (uint32_t s : sizes) segments[0].chunk_bytes += 8 + s + (s & 1) + audio_chunk;
+    uint64_t idx1_size = 16ull * frames * streams;
+
+    // indx super indexes get one entry per segment, patched once the layout is known
+    vector<size_t> indx_entries;
+    ChunkBuilder h;
+    auto buildHeader = [&](size_t entries, uint32_t first_frames) {
+        indx_entries.clear();
+        h.data.clear();
+        auto superIndex = [&](const char* id) {
+            size_t indx = h.open("indx");
+            h.le16(4);              // wLongsPerEntry
+            h.le16(0);              // bIndexSubType, bIndexType = AVI_INDEX_OF_INDEXES
+            h.le32((uint32_t)entries);
+            h.fourcc(id);
+            h.zeros(12);
+            indx_entries.push_back(h.data.size());
+            h.zeros(16 * entries);  // qwOffset, dwSize, dwDuration
+            h.close(indx);
+        };
+
+        size_t hdrl = h.openList("hdrl");
+        size_t avih = h.open("avih");
+        h.le32(33333);              // dwMicroSecPerFrame
+        h.le32(0);                  // dwMaxBytesPerSec
+        h.le32(0);                  // dwPaddingGranularity
+        h.le32(0x10);               // AVIF_HASINDEX
+        h.le32(first_frames);       // dwTotalFrames (first RIFF segment)
+        h.le32(0);                  // dwInitialFrames
+        h.le32(streams);            // dwStreams
+        h.le32(max_frame + 8);      // dwSuggestedBufferSize
+        h.le32(640);
+        h.le32(480);
+        h.zeros(16);
+        h.close(avih);
+
+        size_t strl = h.openList("strl");
+        size_t strh = h.open("strh");
+        h.fourcc("vids");
+        h.fourcc("H264");
+        h.le32(0);                  // dwFlags
+        h.le32(0);                  // wPriority, wLanguage
+        h.le32(0);                  // dwInitialFrames
+        h.le32(1);                  // dwScale
+        h.le32(30);                 // dwRate
+        h.le32(0);                  // dwStart
+        h.le32(frames);             // dwLength
+        h.le32(max_frame);          // dwSuggestedBufferSize
+        h.le32(0xFFFFFFFF);         // dwQuality
+        h.le32(0);                  // dwSampleSize
+        h.zeros(8);                 // rcFrame
+        h.close(strh);
+        size_t strf = h.open("strf");
+        h.le32(40);                 // BITMAPINFOHEADER
+        h.le32(640);
+        h.le32(480);
+        h.le16(1);
+        h.le16(24);
+        h.fourcc("H264");
+        h.le32(640 * 480 * 3);
+        h.zeros(16);
+        h.close(strf);
+        if (entries) superIndex("00dc");
+        h.close(strl);
+
+        if (audio) {
+            strl = h.openList("strl");
+            strh = h.open("strh");
+            h.fourcc("auds");
+            h.le32(0);
+            h.zeros(12);
+            h.le32(4);              // dwScale = block align
+            h.le32(44100 * 4);      // dwRate
+            h.le32(0);
+            h.le32((uint32_t)((uint64_t)frames * options.audio_size / 4));
+            h.le32(options.audio_size);
+            h.le32(0xFFFFFFFF);
+            h.le32(4);
+            h.zeros(8);
+            h.close(strh);
+            strf = h.open("strf");
+            h.le16(1);              // WAVE_FORMAT_PCM
+            h.le16(2);
+            h.le32(44100);
+            h.le32(44100 * 4);
+            h.le16(4);
+            h.le16(16);
+            h.le16(0);
+            h.close(strf);
+            if (entries) superIndex("01wb");
+            h.close(strl);
+        }
+
+        if (entries) {
+            size_t odml = h.openList("odml");
+            size_t dmlh = h.open("dmlh");
+            h.le32(frames);         // dwTotalFrames of all segments
+            h.zeros(244);
+            h.close(dmlh);
+            h.close(odml);
+        }
+        h.close(hdrl);
+    };
+
+    buildHeader(0, frames);
+    uint64_t riff_payload = 4 + h.data.size() + 8 + 4 + segments[0].chunk_bytes + 8 + idx1_size;
+    bool odml = riff_payload > 0xFFFFFFFFull;
+    if (odml) {
+        // past 4 GiB: OpenDML, RIFF 'AVI ' and RIFF 'AVIX' segments of at most
+        // SYNTHETIC_AVI_SEGMENT chunk bytes, an ix## per stream and segment, indx in the header
+        segments.clear();
+        for (uint32_t i = 0; i < frames; i++) {
+            uint64_t bytes = 8 + sizes[i] + (sizes[i] & 1) + audio_chunk;
+            if (segments.empty() || (segments.back().count > 0 && segments.back().chunk_bytes + bytes > SYNTHETIC_AVI_SEGMENT)) {
+                segments.push_back(Segment{ i, 0, 0, 0, 0, 0, 0 });
+            }
+            segments.back().count++;
+            segments.back().chunk_bytes += bytes;
+        }
+        idx1_size = 16ull * segments[0].count * streams;
+        buildHeader(segments.size(), segments[0].count);
+
+        uint64_t pos = 0;
+        for (size_t k = 0; k < segments.size(); k++) {
+            Segment& seg = segments[k];
+            uint64_t header = k == 0 ? h.data.size() : 0;
+            uint64_t ix_bytes = (8 + 24 + 8ull * seg.count) * streams;
+            seg.riff = pos;
+            seg.ix = pos + 12 + header + 12 + seg.chunk_bytes;
+            seg.movi_payload = 4 + seg.chunk_bytes + ix_bytes;
+            seg.riff_payload = 4 + header + 8 + seg.movi_payload + (k == 0 ? 8 + idx1_size : 0);
+            if (seg.riff_payload > 0xFFFFFFFFull) {
+                cerr << "Synthetic AVI frame too large for a RIFF segment (" << seg.riff_payload << " bytes)" << endl;
+                return false;
+            }
+            for (uint32_t st = 0; st < streams; st++) {
+                uint64_t ix_size = 8 + 24 + 8ull * seg.count;
+                uint32_t duration = st == 0 ? seg.count : (uint32_t)((uint64_t)seg.count * options.audio_size / 4);
+                size_t entry = indx_entries[st] + 16 * k;
+                h.set64(entry, seg.ix + st * ix_size);
+                h.set32(entry + 8, (uint32_t)ix_size);
+                h.set32(entry + 12, duration);
+            }
+            pos += 8 + seg.riff_payload;
+        }
+    }
+    else {
+        segments[0].movi_payload = 4 + segments[0].chunk_bytes;
+        segments[0].riff_payload = riff_payload;
+    }
+
+    BlockWriter w(filename, options.seed);
+    if (!w.good()) {
+        cerr << "Error creating file: " << filename << endl;
+        return false;
+    }
+    for (size_t k = 0; k < segments.size(); k++) {
+        const Segment& seg = segments[k];
+        w.fourcc("RIFF");
+        w.le32((uint32_t)seg.riff_payload);
+        w.fourcc(k == 0 ? "AVI " : "AVIX");
+        if (k == 0) w.bytes(h.data);
+        w.fourcc("LIST");
+        w.le32((uint32_t)seg.movi_payload);
+        uint64_t movi_fourcc = w.position();
+        w.fourcc("movi");
+
+        // idx1 offsets are relative to the 'movi' fourcc, so are the ix## entries (qwBaseOffset)
+        vector<uint8_t> idx1;
+        vector<uint8_t> ix[2];
+        if (k == 0) idx1.reserve((size_t)idx1_size);
+        auto put32 = [](vector<uint8_t>& v, uint32_t x) {
+            for (int i = 0; i < 4; i++) v.push_back(uint8_t(x >> (8 * i)));
+        };
+        auto index = [&](uint32_t stream, const char* id, bool key, uint64_t offset, uint32_t size) {
+            if (k == 0) {
+                idx1.insert(idx1.end(), id, id + 4);
+                for (uint32_t v : { key ? 0x10u : 0u, (uint32_t)offset, size }) put32(idx1, v);
+            }
+            if (odml) {
+                // dwOffset points at the payload, bit 31 of dwSize marks a non-key frame
+                put32(ix[stream], (uint32_t)(offset + 8));
+                put32(ix[stream], size | (key ? 0 : 0x80000000u));
+            }
+        };
+        for (uint32_t i = seg.first; i < seg.first + seg.count; i++) {
+            uint32_t s = sizes[i];
+            index(0, "00dc", i % SYNTHETIC_GOP == 0, w.position() - movi_fourcc, s);
+            w.fourcc("00dc");
+            w.le32(s);
+            w.random(s);
+            if (s & 1) w.byte(0);
+            if (audio) {
+                index(1, "01wb", true, w.position() - movi_fourcc, options.audio_size);
+                w.fourcc("01wb");
+                w.le32(options.audio_size);
+                w.random(options.audio_size);
+                if (options.audio_size & 1) w.byte(0);
+            }
+        }
+        if (odml) {
+            for (uint32_t st = 0; st < streams; st++) {
+                w.fourcc(st == 0 ? "ix00" : "ix01");
+                w.le32(24 + 8 * seg.count);
+                w.le32(2 | (1u << 24));     // wLongsPerEntry, bIndexSubType, bIndexType = AVI_INDEX_OF_CHUNKS
+                w.le32(seg.count);
+                w.fourcc(st == 0 ? "00dc" : "01wb");
+                w.le32((uint32_t)movi_fourcc);
+                w.le32((uint32_t)(movi_fourcc >> 32));
+                w.le32(0);
+                w.bytes(ix[st]);
+            }
+        }
+        if (k == 0) {
+            w.fourcc("idx1");
+            w.le32((uint32_t)idx1_size);
+            w.bytes(idx1);
+        }
+    }
+    if (!w.finish()) {
+        cerr << "Error writing file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+bool SyntheticMedia::writeMP4(const string& filename, const Options& options) {
+    bool audio = options.audio_size > 0;
+    vector<uint32_t> sizes = frameSizes(options, 8 + (audio ? options.audio_size + 12 : 0));
+    uint32_t frames = (uint32_t)sizes.size();
+
+    uint64_t mdat_payload = 0;
+    for (uint32_t s : sizes) mdat_payload += s + (audio ? options.audio_size : 0);
+    bool large = mdat_payload + 8 > 0xFFFFFFFFull;
+
+    BoxBuilder ftyp;
+    size_t at = ftyp.open("ftyp");
+    ftyp.fourcc("isom");
+    ftyp.be32(512);
+    ftyp.fourcc("isom");
+    ftyp.fourcc("iso2");
+    ftyp.fourcc("avc1");
+    ftyp.fourcc("mp41");
+    ftyp.close(at);
+
+    // moov for the given sample offsets; a fragmented file has empty tables and mvex instead
+    bool fragmented = options.fragment_frames > 0;
+    auto buildMoov = [&](const vector<uint64_t>& video_offsets, const vector<uint64_t>& audio_offsets, bool co64) {
+        BoxBuilder m;
+        size_t moov = m.open("moov");
+        size_t mvhd = m.openFull("mvhd", 0, 0);
+        m.be32(0);
+        m.be32(0);
+        m.be32(1000);               // timescale
+        m.be32(frames * 1000 / 30); // duration
+        m.be32(0x00010000);         // rate 1.0
+        m.be16(0x0100);             // volume 1.0
+        m.zeros(10);
+        for (uint32_t v : { 0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u }) m.be32(v);
+        m.zeros(24);
+        m.be32(audio ? 3 : 2);      // next track id
+        m.close(mvhd);
+
+        auto trak = [&](uint32_t track_id, bool video, const vector<uint64_t>& offsets) {
+            uint32_t n = (uint32_t)offsets.size();
+            size_t trak_at = m.open("trak");
+            size_t tkhd = m.openFull("tkhd", 0, 3);
+            m.be32(0);
+            m.be32(0);
+            m.be32(track_id);
+            m.be32(0);
+            m.be32(frames * 1000 / 30);
+            m.zeros(8);
+            m.be16(0);
+            m.be16(0);
+            m.be16(video ? 0 : 0x0100);
+            m.be16(0);
+            for (uint32_t v : { 0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u }) m.be32(v);
+            m.be32(video ? 640u << 16 : 0);
+            m.be32(video ? 480u << 16 : 0);
+            m.close(tkhd);
+
+            size_t mdia = m.open("mdia");
+            size_t mdhd = m.openFull("mdhd", 0, 0);
+            m.be32(0);
+            m.be32(0);
+            m.be32(video ? 30 : 44100);
+            m.be32(video ? frames : frames * options.audio_size / 4);
+            m.be16(0x55C4);         // 'und'
+            m.be16(0);
+            m.close(mdhd);
+            size_t hdlr = m.openFull("hdlr", 0, 0);
+            m.be32(0);
+            m.fourcc(video ? "vide" : "soun");
+            m.zeros(12);
+            m.data.push_back(0);
+            m.close(hdlr);
+
+            size_t minf = m.open("minf");
+            if (video) {
+                size_t vmhd = m.openFull("vmhd", 0, 1);
+                m.zeros(8);
+                m.close(vmhd);
+            }
+            else {
+                size_t smhd = m.openFull("smhd", 0, 0);
+                m.zeros(4);
+                m.close(smhd);
+            }
+            size_t dinf = m.open("dinf");
+            size_t dref = m.openFull("dref", 0, 0);
+            m.be32(1);
+            m.close(m.openFull("url ", 0, 1));
+            m.close(dref);
+            m.close(dinf);
+
+            size_t stbl = m.open("stbl");
+            size_t stsd = m.openFull("stsd", 0, 0);
+            m.be32(1);
+            if (video) {
+                size_t avc1 = m.open("avc1");
+                m.zeros(6);
+                m.be16(1);          // data reference index
+                m.zeros(16);
+                m.be16(640);
+                m.be16(480);
+                m.be32(0x00480000);
+                m.be32(0x00480000);
+                m.be32(0);
+                m.be16(1);
+                m.zeros(32);
+                m.be16(0x0018);
+                m.be16(0xFFFF);
+                size_t avcc = m.open("avcC");
+                m.bytes({ 1, 0x64, 0x00, 0x1F, 0xFF, 0xE1 });
+                m.be16(4);
+                m.bytes({ 0x67, 0x64, 0x00, 0x1F });
+                m.data.push_back(1);
+                m.be16(4);
+                m.bytes({ 0x68, 0xEE, 0x3C, 0x80 });
+                m.close(avcc);
+                m.close(avc1);
+            }
+            else {
+                size_t mp4a = m.open("mp4a");
+                m.zeros(6);
+                m.be16(1);
+                m.zeros(8);
+                m.be16(2);
+                m.be16(16);
+                m.zeros(4);
+                m.be32(44100u << 16);
+                m.close(mp4a);
+            }
+            m.close(stsd);
+
+            size_t stts = m.openFull("stts", 0, 0);
+            m.be32(n ? 1 : 0);
+            if (n) {
+                m.be32(n);
+                m.be32(video ? 1 : options.audio_size / 4);
+            }
+            m.close(stts);
+            if (video) {
+                size_t stss = m.openFull("stss", 0, 0);
+                m.be32((n + SYNTHETIC_GOP - 1) / SYNTHETIC_GOP);
+                for (uint32_t i = 0; i < n; i += SYNTHETIC_GOP) m.be32(i + 1);
+                m.close(stss);
+            }
+            size_t stsc = m.openFull("stsc", 0, 0);
+            m.be32(n ? 1 : 0);
+            if (n) {
+                m.be32(1);
+                m.be32(1);
+                m.be32(1);
+            }
+            m.close(stsc);
+            size_t stsz = m.openFull("stsz", 0, 0);
+            if (video) {
+                m.be32(0);
+                m.be32(n);
+                for (uint32_t i = 0; i < n; i++) m.be32(sizes[i]);
+            }
+            else {
+                m.be32(options.audio_size);
+                m.be32(n);
+            }
+            m.close(stsz);
+            size_t stco = m.openFull(co64 ? "co64" : "stco", 0, 0);
+            m.be32(n);
+            for (uint64_t o : offsets) {
+                if (co64) m.be64(o);
+                else m.be32((uint32_t)o);
+            }
+            m.close(stco);
+            m.close(stbl);
+            m.close(minf);
+            m.close(mdia);
+            m.close(trak_at);
+        };
+        trak(1, true, video_offsets);
+        if (audio) trak(2, false, audio_offsets);
+        if (fragmented) {
+            // trex: description 1, one tick per sample, audio samples of a fixed size
+            size_t mvex = m.open("mvex");
+            for (uint32_t track_id = 1; track_id <= (audio ? 2u : 1u); track_id++) {
+                size_t trex = m.openFull("trex", 0, 0);
+                m.be32(track_id);
+                m.be32(1);
+                m.be32(track_id == 1 ? 1 : options.audio_size / 4);
+                m.be32(track_id == 1 ? 0 : options.audio_size);
+                m.be32(0);
+                m.close(trex);
+            }
+            m.close(mvex);
+        }
+        m.close(moov);
+        return m.data;
+    };
+
+    BlockWriter w(filename, options.seed);
+    if (!w.good()) {
+        cerr << "Error creating file: " << filename << endl;
+        return false;
+    }
+    w.bytes(ftyp.data);
+
+    if (fragmented) {
+        // moov up front, then one moof + mdat per fragment_frames frames; the trafs use
+        // default-base-is-moof and data offsets relative to the moof
+        w.bytes(buildMoov({}, {}, false));
+        uint32_t sequence = 1;
+        for (uint32_t first = 0; first < frames; first += options.fragment_frames) {
+            uint32_t count = min(options.fragment_frames, frames - first);
+            uint64_t video_bytes = 0;
+            for (uint32_t i = first; i < first + count; i++) video_bytes += sizes[i];
+            uint64_t audio_bytes = audio ? (uint64_t)count * options.audio_size : 0;
+
+            BoxBuilder f;
+            size_t moof = f.open("moof");
+            size_t mfhd = f.openFull("mfhd", 0, 0);
+            f.be32(sequence++);
+            f.close(mfhd);
+            size_t traf = f.open("traf");
+            size_t tfhd = f.openFull("tfhd", 0, 0x020000);
+            f.be32(1);
+            f.close(tfhd);
+            size_t trun = f.openFull("trun", 0, 0x000201);     // data offset, sample sizes
+            f.be32(count);
+            size_t video_offset_at = f.data.size();
+            f.be32(0);
+            for (uint32_t i = first; i < first + count; i++) f.be32(sizes[i]);
+            f.close(trun);
+            f.close(traf);
+            size_t audio_offset_at = 0;
+            if (audio) {
+                traf = f.open("traf");
+                tfhd = f.openFull("tfhd", 0, 0x020010);         // default sample size
+                f.be32(2);
+                f.be32(options.audio_size);
+                f.close(tfhd);
+                trun = f.openFull("trun", 0, 0x000001);         // data offset
+                f.be32(count);
+                audio_offset_at = f.data.size();
+                f.be32(0);
+                f.close(trun);
+                f.close(traf);
+            }
+            f.close(moof);
+            uint64_t moof_size = f.data.size();
+            f.set32(video_offset_at, uint32_t(moof_size + 8));
+            if (audio) f.set32(audio_offset_at, uint32_t(moof_size + 8 + video_bytes));
+            w.bytes(f.data);
+
+            w.be32(uint32_t(8 + video_bytes + audio_bytes));
+            w.fourcc("mdat");
+            for (uint32_t i = first; i < first + count; i++) {
+                w.be32(sizes[i] - 4);
+                w.byte(i % SYNTHETIC_GOP == 0 ? 0x65 : 0x41);
+                w.random(sizes[i] - 5);
+            }
+            if (audio) w.random((size_t)audio_bytes);
+        }
+    }
+    else {
+        if (large) {
+            w.be32(1);
+            w.fourcc("mdat");
+            w.be64(mdat_payload + 16);
+        }
+        else {
+            w.be32((uint32_t)(mdat_payload + 8));
+            w.fourcc("mdat");
+        }
+
+        // samples: 4-byte NAL length, NAL header (IDR every GOP), payload; audio after every frame
+        vector<uint64_t> video_offsets(frames), audio_offsets(audio ? frames : 0);
+        for (uint32_t i = 0; i < frames; i++) {
+            video_offsets[i] = w.position();
+            w.be32(sizes[i] - 4);
+            w.byte(i % SYNTHETIC_GOP == 0 ? 0x65 : 0x41);
+            w.random(sizes[i] - 5);
+            if (audio) {
+                audio_offsets[i] = w.position();
+                w.random(options.audio_size);
+            }
+        }
+        w.bytes(buildMoov(video_offsets, audio_offsets, w.position() > 0xFFFFFFFFull));
+    }
+    if (!w.finish()) {
+        cerr << "Error writing file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
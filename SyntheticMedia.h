@@ -0,0 +1,52 @@
+// SyntheticMedia.h
+#ifndef SYNTHETICMEDIA_H
+#define SYNTHETICMEDIA_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::string;
+using std::vector;
+
+// keyframe interval of the generated streams
+#define SYNTHETIC_GOP 30
+// write buffer of the generators
+#define SYNTHETIC_WRITE_BLOCK (1u << 20)
+// stream chunk bytes per RIFF segment of an OpenDML AVI
+#define SYNTHETIC_AVI_SEGMENT (1ull << 30)
+
+/**
+*  SyntheticMedia
+* @brief Writes structurally valid AVI and MP4 files of any size for benchmarks, no media needed.
+* @details Frames are random bytes with the container structure around them: an AVI gets hdrl,
+*  one movi list with 00dc/01wb chunks and an idx1 (past 4 GiB OpenDML: RIFF AVIX segments, an
+*  ix00/ix01 per movi list and indx super indexes, idx1 for the first segment only); an MP4 gets ftyp, one mdat with
+*  length-prefixed H.264-style NAL units and interleaved audio samples, then a moov with a video
+*  and an audio track (co64 and a 64-bit mdat size past 4 GiB), or with fragment_frames set a
+*  fragmented MP4: moov with mvex/trex, then a moof (tfhd + trun per track) and an mdat for every
+*  fragment_frames frames. Frame sizes vary by +-25% around
+*  frame_size, so the frame density is set by size / frame_size. Output depends only on the options.
+*  Files are written in blocks, memory use does not depend on the file size.
+* @author AXIS5 with assistance from LLM
+*/
+class SyntheticMedia {
+public:
+    struct Options {
+        uint64_t size = 64ull << 20;    // approximate file size
+        uint32_t frame_size = 20000;    // mean video frame size
+        uint32_t audio_size = 512;      // audio chunk after every video frame, 0 = no audio
+        uint64_t seed = 1;
+        uint32_t fragment_frames = 0;   // MP4: frames per moof/mdat fragment, 0 = one mdat
+    };
+
+    //false on I/O errors
+    static bool writeAVI(const string& filename, const Options& options);
+    static bool writeMP4(const string& filename, const Options& options);
+
+    //video frame sizes the generators will use for these options
+    static vector<uint32_t> frameSizes(const Options& options, uint32_t per_frame_overhead);
+};
+
+#endif // !SYNTHETICMEDIA_H
@@ -0,0 +1,72 @@
+// ThreadPool.cpp
+#include "ThreadPool.h"
+
+using namespace std;
+
+size_t ThreadPool::hardwareThreads() {
+    size_t n = thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+ThreadPool::ThreadPool(size_t threads) : job(nullptr), job_count(0), next_index(0), busy(0), generation(0), stopping(false) {
+    if (threads == 0) threads = hardwareThreads();
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+void ThreadPool::parallelFor(size_t count, const function<void(size_t)>& fn) {
+    if (count == 0) return;
+    if (workers.empty() || count == 1) {
+        for (size_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        job_count = count;
+        next_index = 0;
+        busy = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    runJob();
+
+    unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::runJob() {
+    size_t i;
+    while ((i = next_index.fetch_add(1)) < job_count) {
+        (*job)(i);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runJob();
+        {
+            lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        done.notify_one();
+    }
+}
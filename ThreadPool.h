@@ -0,0 +1,58 @@
+// ThreadPool.h
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+using std::vector;
+
+/**
+*  ThreadPool
+* @brief Fixed set of worker threads running index loops.
+* @details parallelFor hands out indices through one atomic counter, the calling thread works
+*  along and the call returns when every index is done. A pool of size 1 has no workers and
+*  runs everything on the caller.
+* @author AXIS5 with assistance from LLM
+*/
+class ThreadPool {
+public:
+    //threads including the caller, 0 = one per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //threads including the caller
+    size_t size() const { return workers.size() + 1; }
+
+    //run fn(i) for every i in [0, count)
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    //hardware threads, at least 1
+    static size_t hardwareThreads();
+
+private:
+    vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* job;
+    size_t job_count;
+    std::atomic<size_t> next_index;
+    size_t busy;
+    uint64_t generation;
+    bool stopping;
+
+    void workerLoop();
+    void runJob();
+};
+
+#endif // !THREADPOOL_H
@@ -0,0 +1,302 @@
+// VideoCorruptor.cpp
+#include "VideoCorruptor.h"
+#include "ThreadPool.h"
+#include <queue>
+#include <functional>
+
+using namespace std;
+
+// glitches per planning task
+#define GLITCH_PLAN_BLOCK 4096
+// apply tasks per thread, evens out groups of different size
+#define GLITCH_TASKS_PER_THREAD 8
+// copy offsets drawn per fillBelow call
+#define GLITCH_OFFSET_BLOCK 64
+// apply rounds per thread while the output is written behind them
+#define GLITCH_SAVE_ROUNDS 64
+
+bool VideoCorruptor::finishRead() {
+    // a failed load has released the buffer
+    if (!file_data.loading()) return !file_data.empty() || metrics.file_size == 0;
+    bool ok = file_data.finishLoad();
+    metrics.addPhase("read", CorruptionMetrics::since(read_start));
+    return ok;
+}
+
+bool VideoCorruptor::beginSave(const string& filename) {
+    return file_data.beginSave(filename);
+}
+
+vector<SignatureScanner::Hit> VideoCorruptor::scanLoading(const SignatureScanner& scanner) {
+    const uint8_t* data = file_data.data();
+    size_t size = file_data.size();
+    vector<SignatureScanner::Hit> hits;
+    // a hit is only final once every byte a pattern may span is in, the chunk scans stop
+    // SCANNER_MAX_PATTERN_LENGTH bytes short of the loaded prefix
+    size_t scanned = 0;
+    ThreadPool pool(thread_count);
+    while (file_data.loading()) {
+        size_t want = min(size, scanned + ASYNC_IO_CHUNK + SCANNER_MAX_PATTERN_LENGTH);
+        size_t loaded = file_data.waitLoaded(want);
+        // a failed read is reported by finishRead
+        if (loaded < want || loaded == size) break;
+        size_t end = loaded - SCANNER_MAX_PATTERN_LENGTH;
+        vector<SignatureScanner::Hit> part = scanner.scan(pool, data, loaded, scanned, end);
+        hits.insert(hits.end(), part.begin(), part.end());
+        scanned = end;
+    }
+    if (file_data.waitLoaded(size) == size) {
+        vector<SignatureScanner::Hit> part = scanner.scan(pool, data, size, scanned, size);
+        hits.insert(hits.end(), part.begin(), part.end());
+    }
+    return hits;
+}
+
+vector<SignatureScanner::Hit> VideoCorruptor::scanFile(const SignatureScanner& scanner) {
+    ThreadPool pool(thread_count);
+    return scanner.scan(pool, file_data.data(), file_data.size(), 0, file_data.size());
+}
+
+void VideoCorruptor::gatherCopySource(const Glitch& g, GlitchRandom& r, uint32_t min_offset, uint32_t spread, uint8_t* operand) const {
+    const uint8_t* data = file_data.data();
+    uint32_t offsets[GLITCH_OFFSET_BLOCK];
+    for (uint32_t j0 = 0; j0 < g.len; j0 += GLITCH_OFFSET_BLOCK) {
+        uint32_t n = min<uint32_t>(GLITCH_OFFSET_BLOCK, g.len - j0);
+        r.fillBelow(offsets, n, spread);
+        for (uint32_t k = 0; k < n; k++) {
+            size_t at = g.pos + j0 + k;
+            size_t copy_offset = min_offset + offsets[k];
+            // nothing before the start of the file: the byte stays as it is
+            operand[j0 + k] = data[at >= copy_offset ? at - copy_offset : at];
+        }
+    }
+}
+
+vector<size_t> VideoCorruptor::addGlitchSweep(vector<Glitch>& plan, vector<vector<size_t>>& stage_positions) {
+    vector<size_t> added(stage_positions.size(), 0);
+    size_t total = 0;
+    for (auto& positions : stage_positions) {
+        // windows added out of address order draw out of order
+        if (!is_sorted(positions.begin(), positions.end())) sort(positions.begin(), positions.end());
+        total += positions.size();
+    }
+    plan.reserve(plan.size() + total);
+
+    // k-way merge by position, the lower stage wins a tie
+    typedef pair<size_t, size_t> Head;     // position, stage
+    priority_queue<Head, vector<Head>, greater<Head>> heads;
+    vector<size_t> next(stage_positions.size(), 0);
+    for (size_t s = 0; s < stage_positions.size(); s++) {
+        if (!stage_positions[s].empty()) heads.push({ stage_positions[s][0], s });
+    }
+    while (!heads.empty()) {
+        Head h = heads.top();
+        heads.pop();
+        size_t s = h.second;
+        if (addGlitch(plan, h.first, stages[s].burst_size, (int)s)) added[s]++;
+        if (++next[s] < stage_positions[s].size()) heads.push({ stage_positions[s][next[s]], s });
+    }
+    return added;
+}
+
+void VideoCorruptor::runGlitches(vector<Glitch>& plan) {
+    if (plan.empty()) return;
+    auto start_time = chrono::steady_clock::now();
+    ThreadPool pool(thread_count);
+    uint8_t* data = file_data.data();
+
+    // every glitch owns len bytes in the scratch pools
+    size_t pool_bytes = 0;
+    for (auto& g : plan) {
+        g.slot = pool_bytes;
+        pool_bytes += g.len;
+    }
+    vector<uint8_t> operand(pool_bytes);
+
+    // plan: pick operations, draw all random bytes in bulk and gather copy sources
+    // while the file is still pristine
+    size_t plan_blocks = (plan.size() + GLITCH_PLAN_BLOCK - 1) / GLITCH_PLAN_BLOCK;
+    pool.parallelFor(plan_blocks, [&](size_t b) {
+        size_t end = min(plan.size(), (b + 1) * GLITCH_PLAN_BLOCK);
+        for (size_t i = b * GLITCH_PLAN_BLOCK; i < end; i++) {
+            GlitchRandom r(seed, plan[i].seq);
+            planGlitch(plan[i], r, operand.data() + plan[i].slot);
+        }
+    });
+
+    // per stage and per operation counts
+    for (const auto& g : plan) {
+        if (g.stage >= metrics.stages.size()) metrics.stages.resize(g.stage + 1);
+        metrics.stages[g.stage].applied++;
+        metrics.stages[g.stage].mutated_bytes += g.len;
+        if (g.op >= 0 && g.op < GLITCH_MAX_OPS) metrics.op_counts[g.op]++;
+    }
+
+    // glitches whose bursts overlap form one group and stay on one thread, in plan order
+    vector<size_t> order(plan.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    // a plan compiled by addGlitchSweep is in address order already
+    bool swept = is_sorted(plan.begin(), plan.end(), [](const Glitch& a, const Glitch& b) { return a.pos < b.pos; });
+    if (!swept) {
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return plan[a].pos != plan[b].pos ? plan[a].pos < plan[b].pos : a < b;
+        });
+    }
+    vector<size_t> group_begin;
+    size_t group_end = 0;
+    for (size_t k = 0; k < order.size(); k++) {
+        const Glitch& g = plan[order[k]];
+        if (k == 0 || g.pos >= group_end) group_begin.push_back(k);
+        group_end = max(group_end, g.pos + g.len);
+    }
+    group_begin.push_back(order.size());
+
+    // cut the groups into tasks of roughly equal glitch count; a save in progress wants
+    // finer rounds, see below
+    bool saving = file_data.saving();
+    size_t tasks_wanted = pool.size() * (saving ? GLITCH_SAVE_ROUNDS : GLITCH_TASKS_PER_THREAD);
+    size_t per_task = max<size_t>(1, order.size() / tasks_wanted);
+    vector<size_t> task_begin;
+    for (size_t gi = 0; gi + 1 < group_begin.size(); gi++) {
+        if (task_begin.empty() || group_begin[gi] - group_begin[task_begin.back()] >= per_task) {
+            task_begin.push_back(gi);
+        }
+    }
+    task_begin.push_back(group_begin.size() - 1);
+
+    vector<uint8_t> old_bytes, new_bytes;
+    bool keep_old = journal || track_undo;
+    if (keep_old) old_bytes.resize(pool_bytes);
+    if (journal) new_bytes.resize(pool_bytes);
+    auto run_task = [&](size_t t) {
+        for (size_t gi = task_begin[t]; gi < task_begin[t + 1]; gi++) {
+            auto first = order.begin() + group_begin[gi];
+            auto last = order.begin() + group_begin[gi + 1];
+            if (last - first > 1) sort(first, last);
+            for (auto it = first; it != last; ++it) {
+                const Glitch& g = plan[*it];
+                if (keep_old) memcpy(old_bytes.data() + g.slot, data + g.pos, g.len);
+                applyGlitch(g, operand.data() + g.slot);
+                if (journal) memcpy(new_bytes.data() + g.slot, data + g.pos, g.len);
+            }
+        }
+    };
+    size_t task_count = task_begin.size() - 1;
+    if (!saving) {
+        pool.parallelFor(task_count, run_task);
+    }
+    else {
+        // tasks are in address order and groups never overlap: after a round of one task per
+        // thread every byte below the next round's first glitch is final and can be written
+        // while the following rounds run
+        for (size_t t0 = 0; t0 < task_count; t0 += pool.size()) {
+            size_t n = min(pool.size(), task_count - t0);
+            pool.parallelFor(n, [&](size_t i) { run_task(t0 + i); });
+            if (t0 + n < task_count) file_data.saveUpTo(plan[order[group_begin[task_begin[t0 + n]]]].pos);
+        }
+    }
+
+    // what now differs from the loaded file, a cloned save writes only these bytes
+    for (size_t k : order) file_data.markDirty(plan[k].pos, plan[k].pos + plan[k].len);
+
+    // journal entries in plan order, so overlapping bursts replay correctly
+    if (journal) {
+        for (const auto& g : plan) {
+            journal->record(g.pos, old_bytes.data() + g.slot, new_bytes.data() + g.slot, g.len);
+        }
+    }
+
+    if (track_undo) {
+        size_t base = undo_bytes.size();
+        undo_bytes.insert(undo_bytes.end(), old_bytes.begin(), old_bytes.end());
+        for (auto g : plan) {
+            g.slot += base;
+            undo_glitches.push_back(g);
+        }
+    }
+    metrics.addPhase("apply", CorruptionMetrics::since(start_time));
+}
+
+void VideoCorruptor::restorePristine() {
+    // newest first, so overlapping bursts end with the oldest bytes
+    uint8_t* data = file_data.data();
+    for (auto it = undo_glitches.rbegin(); it != undo_glitches.rend(); ++it) {
+        memcpy(data + it->pos, undo_bytes.data() + it->slot, it->len);
+    }
+    undo_glitches.clear();
+    undo_bytes.clear();
+}
+
+size_t VideoCorruptor::generateVariants(const vector<Variant>& variants) {
+    vector<CorruptionStage> default_stages = stages;
+    CorruptionJournal* user_journal = journal;
+    size_t written = 0;
+    track_undo = true;
+    // restorePristine brings the buffer back to this state, and its dirty ranges with it
+    RangeSet dirty = file_data.dirtyRanges();
+    for (size_t i = 0; i < variants.size(); i++) {
+        const Variant& v = variants[i];
+        log() << "=== Variant " << (i + 1) << "/" << variants.size() << " ===" << std::endl;
+        setSeed(v.seed);
+        stages = v.stages.empty() ? default_stages : v.stages;
+        CorruptionJournal variant_journal;
+        variant_journal.setSourceSize(file_data.size());
+        journal = v.journal.empty() ? nullptr : &variant_journal;
+
+        applyCorruption();
+        bool ok = true;
+        if (journal) {
+            ok = variant_journal.save(v.journal);
+            if (ok) log() << "Journal saved to: " << v.journal << std::endl;
+        }
+        if (ok && !v.output.empty()) {
+            ok = saveFile(v.output);
+            if (ok) log() << "Corrupted video saved to: " << v.output << std::endl;
+        }
+        if (ok && !v.metrics.empty()) {
+            ok = metrics.save(v.metrics);
+        }
+        if (ok) written++;
+        restorePristine();
+        file_data.setDirtyRanges(dirty);
+    }
+    track_undo = false;
+    journal = user_journal;
+    stages = default_stages;
+    return written;
+}
+
+bool VideoCorruptor::loadAnalysis(AnalysisIndex& index, uint32_t format) {
+    analysis_cached = false;
+    if (!use_analysis_cache || source_name.empty()) return false;
+    auto start_time = chrono::high_resolution_clock::now();
+    if (!AnalysisIndex::identify(source_name, file_data.data(), file_data.size(), source_identity)) {
+        source_name.clear();
+        return false;
+    }
+    string sidecar = AnalysisIndex::sidecarPath(source_name);
+    if (!index.load(sidecar, source_identity, format)) return false;
+
+    protected_ranges.clear();
+    for (const auto& r : index.protected_ranges) protected_ranges.add(r.begin, r.end);
+    protected_ranges.normalize();
+    frmcount = index.frame_count;
+    analysis_cached = true;
+    metrics.analysis_cached = true;
+    auto end_time = chrono::high_resolution_clock::now();
+    log() << "Analysis loaded from " << sidecar << " in "
+        << chrono::duration_cast<chrono::milliseconds>(end_time - start_time).count() << "ms" << endl;
+    return true;
+}
+
+void VideoCorruptor::saveAnalysis(const AnalysisIndex& index) {
+    // identity is computed by loadAnalysis, empty name = caching off or the file cannot be stat'ed
+    if (!use_analysis_cache || source_name.empty()) return;
+    string sidecar = AnalysisIndex::sidecarPath(source_name);
+    if (index.save(sidecar, source_identity)) {
+        log() << "Analysis saved to " << sidecar << endl;
+    }
+    else {
+        log() << "Warning: could not write analysis index " << sidecar << endl;
+    }
+}
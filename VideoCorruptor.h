@@ -9,6 +9,15 @@
 #include <cstring>
 #include <chrono>
 #include <algorithm>
+#include <iostream>
+#include "FileBuffer.h"
+#include "CorruptionJournal.h"
+#include "RangeSet.h"
+#include "GlitchRandom.h"
+#include "GlitchKernels.h"
+#include "AnalysisIndex.h"
+#include "CorruptionMetrics.h"
+#include "SignatureScanner.h"
 using std::vector;
 using std::mt19937;
 using std::string;
@@ -20,36 +29,218 @@ using std::string;
 * @author AXIS5 with assistance from LLM
 */
 class VideoCorruptor {
-protected:
-    vector<uint8_t> file_data;
-    mt19937 rng;
-    vector<bool> protected_mask;
-    int frmcount;
-
+    // drives the glitch engine region by region
+    friend class StreamCorruptor;
+    // drives analysis and corruption on caller-owned buffers
+    friend class BufferCorruptor;
+public:
 	// Corruption stage definition
     struct CorruptionStage {
 		double start_ratio; // Start position ratio (0.0-1.0)
         double end_ratio; // End position ratio (0.0-1.0)
 		double intensity; // Corruption intensity (0.0-1.0)
 		int burst_size; // Number of bytes to corrupt per glitch
+        unsigned target = 0; // NAL unit classes to hit (NAL_CLASS_* of NalIndex.h), 0 = any byte of the window
+    };
+
+    // one output of generateVariants
+    struct Variant {
+        uint64_t seed;
+        vector<CorruptionStage> stages;     // empty = the format's default stages
+        string output;                      // corrupted file, empty = don't write
+        string journal;                     // journal file, empty = don't record
+        string metrics;                     // JSON metrics file, empty = don't write
     };
+protected:
+    FileBuffer file_data;
+    mt19937 rng;
+    RangeSet protected_ranges;
+    uint64_t frmcount;
     vector<CorruptionStage> stages;
+    // map the input copy-on-write instead of reading it into memory
+    bool use_mmap;
+    // optional mutation journal (not owned)
+    CorruptionJournal* journal;
+    // position sampling and every glitch stream derive from the seed
+    uint64_t seed;
+    // threads used by runGlitches, 0 = one per hardware thread
+    size_t thread_count;
+    // progress and info output (not owned)
+    std::ostream* log_stream;
+    // keep the old bytes of every glitch so restorePristine can undo them
+    bool track_undo;
+    // reuse / write the analysis sidecar of the input
+    bool use_analysis_cache;
+    // the last analyze() was answered from the sidecar
+    bool analysis_cached;
+    // file read by readFileData and its identity for the sidecar
+    string source_name;
+    AnalysisIndex::Identity source_identity;
+    // counters and timings of the current input
+    CorruptionMetrics metrics;
+    // start of readFileData, the read phase lasts until the background load is complete
+    std::chrono::steady_clock::time_point read_start;
+
+    // one glitch of a corruption run
+    struct Glitch {
+        size_t pos;         // first byte of the burst
+        uint32_t len;       // burst length, already clipped at protected bytes
+        uint16_t stage;
+        int16_t op;         // operation picked by planGlitch
+        uint64_t seq;       // position in the serial order, names the RNG stream
+        size_t slot;        // offset of this glitch's len bytes in the scratch pools
+    };
 public:
 
-    VideoCorruptor(): rng(std::chrono::steady_clock::now().time_since_epoch().count()), frmcount(0) {}
+    VideoCorruptor(): frmcount(0), use_mmap(false), journal(nullptr), thread_count(0), log_stream(&std::cout), track_undo(false),
+        use_analysis_cache(false), analysis_cached(false) {
+        setSeed(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
     virtual ~VideoCorruptor() = default;
 
-    //Load file into memory
-    virtual bool loadFile(const string& filename) = 0;
+    //Load file into memory and analyze it
+    bool loadFile(const string& filename) { return readFile(filename) && analyze(); }
+
+    //Read the file only, cheap on CPU (I/O stage of a batch); without mmap the bytes keep
+    //arriving in the background after it returns
+    virtual bool readFile(const string& filename) = 0;
+
+    //wait until the file of readFile is in memory; false if reading it failed
+    bool finishRead();
+
+    //Find the structures to protect in the loaded file (CPU stage of a batch)
+    virtual bool analyze() = 0;
 
     //Save corrupted file to disk
     virtual bool saveFile(const string& filename)=0;
 
+    //open the output before applyCorruption, so the corrupted front of the file is written while
+    //the rest is still being corrupted; saveFile with the same name completes it
+    bool beginSave(const string& filename);
+
     //Corrupt
     virtual void applyCorruption()=0;
 
     virtual void printFileInfo()=0;
+
+    //corrupt the loaded file once per variant, restoring the pristine bytes in between;
+    //load and analysis are paid once. Returns the number of variants written successfully
+    size_t generateVariants(const vector<Variant>& variants);
+
+    const vector<CorruptionStage>& getStages() const { return stages; }
+    void setStages(const vector<CorruptionStage>& s) { stages = s; }
+
+    //aim every stage at these NAL unit classes (NAL_CLASS_*), 0 = whole windows; formats without a NAL index ignore it
+    void setTarget(unsigned classes) {
+        for (auto& stage : stages) stage.target = classes;
+    }
+
+    //enable memory-mapped (copy-on-write) loading, must be set before loadFile
+    void setMemoryMapped(bool enable) { use_mmap = enable; }
+
+    //seed the run; the same seed and input give the same output for any thread count
+    void setSeed(uint64_t s) {
+        seed = s;
+        metrics.seed = s;
+        std::seed_seq seq{ uint32_t(s), uint32_t(s >> 32) };
+        rng.seed(seq);
+    }
+    uint64_t getSeed() const { return seed; }
+
+    //threads for applying glitches, 0 = one per hardware thread
+    void setThreads(size_t threads) { thread_count = threads; }
+
+    //send progress and info output to another stream
+    void setLog(std::ostream* stream) { log_stream = stream; }
+
+    //counters and timings of the current input (load, analysis, last corruption, save)
+    const CorruptionMetrics& getMetrics() const { return metrics; }
+
+    //keep the analysis in <input>.vcidx and skip it on later runs while the input is unchanged,
+    //must be set before analyze
+    void setAnalysisCache(bool enable) { use_analysis_cache = enable; }
+
+    //record every mutation made by applyCorruption into this journal (nullptr to disable)
+    void setJournal(CorruptionJournal* j) {
+        journal = j;
+        if (journal && !file_data.empty()) journal->setSourceSize(file_data.size());
+    }
 protected:
+    std::ostream& log() { return *log_stream; }
+
+    // glitches applied while track_undo is on, with their old bytes
+    vector<Glitch> undo_glitches;
+    vector<uint8_t> undo_bytes;
+
+    //read the input file into file_data; a copy keeps loading in the background, see finishRead
+    bool readFileData(const string& filename) {
+        read_start = std::chrono::steady_clock::now();
+        bool ok = use_mmap ? file_data.loadMapped(filename) : file_data.loadAsync(filename);
+        source_name = filename;
+        analysis_cached = false;
+        metrics.reset();
+        metrics.input = filename;
+        metrics.file_size = file_data.size();
+        metrics.seed = seed;
+        if (!file_data.loading()) metrics.addPhase("read", CorruptionMetrics::since(read_start));
+        if (ok && journal) journal->setSourceSize(file_data.size());
+        // runGlitches reports every byte it changes, see FileBuffer::trackWrites
+        if (ok) file_data.trackWrites();
+        return ok;
+    }
+
+    //scan the file with scanner while it is still loading, chunk by chunk as the reads complete;
+    //the hits equal scanner.scan over the whole file, which is in memory when this returns
+    vector<SignatureScanner::Hit> scanLoading(const SignatureScanner& scanner);
+
+    //scanner.scan over the whole loaded file, on thread_count threads
+    vector<SignatureScanner::Hit> scanFile(const SignatureScanner& scanner);
+
+    //bytes a burst at pos may touch: it stops at the next protected byte or at the end of the file
+    size_t burstLength(size_t pos, size_t burst_size) const {
+        if (pos >= file_data.size()) return 0;
+        size_t len = std::min(burst_size, file_data.size() - pos);
+        return std::min(len, protected_ranges.distanceToNext(pos));
+    }
+
+    //fill index from the sidecar of the loaded file; false if caching is off or it is stale
+    bool loadAnalysis(AnalysisIndex& index, uint32_t format);
+
+    //write the sidecar of the loaded file (failures only warn)
+    void saveAnalysis(const AnalysisIndex& index);
+
+    //append a glitch at pos to the plan; false if nothing there can be touched
+    bool addGlitch(vector<Glitch>& plan, size_t pos, size_t burst_size, int stage) {
+        size_t len = burstLength(pos, burst_size);
+        if (len == 0) return false;
+        plan.push_back({ pos, (uint32_t)len, (uint16_t)stage, 0, (uint64_t)plan.size(), 0 });
+        return true;
+    }
+
+    //append the positions of every stage (each in address order) to the plan as one
+    //address-ordered sweep, lower stages first at equal positions; returns the glitches added per stage
+    vector<size_t> addGlitchSweep(vector<Glitch>& plan, vector<vector<size_t>>& stage_positions);
+
+    //plan and apply all glitches in parallel; deterministic for any thread count, copy sources are
+    //read from the file before any glitch is applied
+    void runGlitches(vector<Glitch>& plan);
+
+    //undo every glitch applied since track_undo was switched on
+    void restorePristine();
+
+    //pick the operation and fill operand (len bytes) with everything it needs: a bulk block
+    //of random bytes, or the bytes it copies; runs before any glitch is applied, so it sees the pristine file
+    virtual void planGlitch(Glitch& g, GlitchRandom& r, uint8_t* operand) = 0;
+
+    //mutate file_data[g.pos, g.pos + g.len), no random draws left at this point
+    virtual void applyGlitch(const Glitch& g, const uint8_t* operand) = 0;
+
+    //operand of copy-from-previous: byte j comes from min_offset + [0, spread) bytes before pos + j
+    void gatherCopySource(const Glitch& g, GlitchRandom& r, uint32_t min_offset, uint32_t spread, uint8_t* operand) const;
+
+    //number of glitches a stage gets for frmcount frames
+    virtual size_t stageGlitches(const CorruptionStage& stage) const = 0;
+
 	//find potential frame start positions
     virtual vector<size_t> findPotentialFrameStarts()=0;
 
@@ -2,52 +2,279 @@
 #include <cctype>
 #include"MP4Corruptor.h"
 #include"AVICorruptor.h"
+#include"BatchRunner.h"
+#include"StreamCorruptor.h"
+#include"NalIndex.h"
+#include <fstream>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <fcntl.h>
+#endif
 using namespace std;
+
+// out.mp4 -> out_3.mp4
+static string variantName(const string& name, size_t index) {
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)) dot = name.size();
+    return name.substr(0, dot) + "_" + to_string(index) + name.substr(dot);
+}
+
 int main(int argc, char* argv[]) {
     
 #if defined(_WIN32) || defined(_WIN64)
     system("chcp 65001>nul");
 #endif
-    if (argc != 4) {
+    // journal tools: --replay/--revert <journal> <input> <output>
+    if (argc == 5 && (string(argv[1]) == "--replay" || string(argv[1]) == "--revert")) {
+        CorruptionJournal journal;
+        if (!journal.load(argv[2])) {
+            return 1;
+        }
+        bool ok = string(argv[1]) == "--replay" ? journal.replay(argv[3], argv[4]) : journal.revert(argv[3], argv[4]);
+        if (!ok) {
+            cerr << "Journal apply failed." << endl;
+            return 1;
+        }
+        cout << "Applied " << journal.size() << " journal entries, output saved to: " << argv[4] << endl;
+        return 0;
+    }
+
+    vector<string> args;
+    bool use_mmap = false;
+    bool use_cache = false;
+    bool quiet = false;
+    string metrics_file;
+    string journal_file;
+    bool journal_only = false;
+    bool has_seed = false;
+    uint64_t seed = 0;
+    size_t threads = 0;
+    bool has_threads = false;
+    string batch_source;
+    size_t jobs = 0;
+    size_t variants = 0;
+    bool stream = false;
+    size_t window_mib = 0;
+    unsigned target = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--mmap") {
+            use_mmap = true;
+        }
+        else if (arg == "--quiet") {
+            quiet = true;
+        }
+        else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_file = argv[++i];
+        }
+        else if (arg == "--cache") {
+            use_cache = true;
+        }
+        else if (arg == "--journal" && i + 1 < argc) {
+            journal_file = argv[++i];
+        }
+        else if (arg == "--journal-only") {
+            journal_only = true;
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 0);
+            has_seed = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+            has_threads = true;
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batch_source = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--variants" && i + 1 < argc) {
+            variants = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--stream") {
+            stream = true;
+        }
+        else if (arg == "--window" && i + 1 < argc) {
+            window_mib = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--target" && i + 1 < argc) {
+            target = NalIndex::parseClasses(argv[++i]);
+            if (!target) {
+                cerr << "Unknown NAL class in --target: " << argv[i] << " (idr, slices, params, other, all)" << endl;
+                return 1;
+            }
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+    // batch: --batch <manifest> or --batch <directory> <output directory>
+    if (!batch_source.empty() && args.size() <= 1 && journal_file.empty()) {
+        BatchRunner batch;
+        bool ok = args.empty() ? batch.addManifest(batch_source) : batch.addDirectory(batch_source, args[0]);
+        if (!ok) {
+            return 1;
+        }
+        BatchRunner::Options options;
+        options.use_mmap = use_mmap;
+        options.use_cache = use_cache;
+        options.quiet = quiet;
+        options.metrics_file = metrics_file;
+        options.has_seed = has_seed;
+        options.seed = seed;
+        options.threads = has_threads ? threads : 1;
+        options.jobs = jobs;
+        options.target = target;
+        size_t failed = batch.run(options);
+        if (!quiet) cout << "Batch finished: " << batch.getJobs().size() - failed << "/" << batch.getJobs().size() << " files corrupted" << endl;
+        return failed ? 1 : 0;
+    }
+
+    if (args.size() != 3 || (journal_only && journal_file.empty()) || !batch_source.empty()) {
 		cout << "The corruptor supports MP4 and AVI formats." << endl;
-        cout << "usage: " << argv[0] << " <input file> <output file> [AVI|MP4]" << endl;
+        cout << "usage: " << argv[0] << " <input file> <output file> [AVI|MP4] [options]" << endl;
+        cout << "       " << argv[0] << " --replay <journal> <source file> <output file>" << endl;
+        cout << "       " << argv[0] << " --revert <journal> <corrupted file> <output file>" << endl;
+        cout << "       " << argv[0] << " --batch <manifest> [options]" << endl;
+        cout << "       " << argv[0] << " --batch <input directory> <output directory> [options]" << endl;
+        cout << "options:" << endl;
+        cout << "  --mmap              map the input copy-on-write instead of reading it into memory" << endl;
+        cout << "  --quiet             no progress output, only errors" << endl;
+        cout << "  --metrics <file>    write counters and phase timings as JSON (\"-\" = stdout)" << endl;
+        cout << "  --cache             reuse the analysis saved in <input>.vcidx, write it if missing or stale" << endl;
+        cout << "  --journal <file>    record every mutation into a journal file" << endl;
+        cout << "  --journal-only      write only the journal, not the output file" << endl;
+        cout << "  --seed <n>          seed the run, same seed gives the same output" << endl;
+        cout << "  --threads <n>       worker threads per file (default: all hardware threads, 1 in batch mode)" << endl;
+        cout << "  --jobs <n>          files corrupted in parallel in batch mode (default: all hardware threads)" << endl;
+        cout << "  --variants <n>      load and analyze once, write n outputs (<output>_1 ... _n) with seeds seed ... seed+n-1" << endl;
+        cout << "  --stream            corrupt in one forward pass with fixed memory; input/output \"-\" is stdin/stdout" << endl;
+        cout << "  --window <MiB>      working window of --stream (default: 16)" << endl;
+        cout << "  --target <classes>  MP4: draw glitches only inside these NAL units: idr, slices (P/B), params, other, all" << endl;
+        cout << "                      comma separated, e.g. --target slices" << endl;
         cout << "example: " << argv[0] << " input.mp4 corrupted_output.mp4 MP4" << endl;
         return 1;
     }
 
-    string input_file = argv[1];
-    string output_file = argv[2];
-    string fmt = argv[3];
-    VideoCorruptor* corruptor = nullptr;
-    transform(fmt.begin(), fmt.end(), fmt.begin(), (int (*)(int))tolower);
-    if (fmt=="avi") {
-		corruptor = new AVICorruptor();
-    }
-    else if (fmt == "mp4") {
-        corruptor = new MP4Corruptor();
+    string input_file = args[0];
+    string output_file = args[1];
+    string fmt = args[2];
+
+    // streaming: stdin/stdout pipelines and files larger than memory, logs go to stderr
+    if (stream || input_file == "-" || output_file == "-") {
+        if (!journal_file.empty() || variants > 0 || use_mmap || !metrics_file.empty() || target) {
+            cerr << "--journal, --variants, --mmap, --metrics and --target are not available with --stream." << endl;
+            return 1;
+        }
+        StreamCorruptor streamer(fmt);
+        if (!streamer.valid()) {
+            cerr << "Unsupported format: " << fmt << ". Supported formats are AVI and MP4." << endl;
+            return 1;
+        }
+        if (window_mib > 0) streamer.setWindow(window_mib << 20);
+        streamer.setThreads(threads);
+        ostream null_log(nullptr);
+        if (quiet) streamer.setLog(&null_log);
+        if (has_seed) streamer.setSeed(seed);
+#if defined(_WIN32) || defined(_WIN64)
+        if (input_file == "-") _setmode(_fileno(stdin), _O_BINARY);
+        if (output_file == "-") _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ifstream in_file;
+        ofstream out_file;
+        if (input_file != "-") {
+            in_file.open(input_file, ios::binary);
+            if (!in_file) {
+                cerr << "Error opening file: " << input_file << endl;
+                return 1;
+            }
+        }
+        if (output_file != "-") {
+            out_file.open(output_file, ios::binary | ios::trunc);
+            if (!out_file) {
+                cerr << "Error creating file: " << output_file << endl;
+                return 1;
+            }
+        }
+        istream& in = input_file == "-" ? cin : in_file;
+        ostream& out = output_file == "-" ? cout : out_file;
+        if (!streamer.run(in, out)) {
+            return 1;
+        }
+        if (output_file != "-" && !quiet) cerr << "Corrupted video saved to: " << output_file << endl;
+        return 0;
     }
-    else {
+    VideoCorruptor* corruptor = BatchRunner::createCorruptor(fmt);
+    if (!corruptor) {
         cerr << "Unsupported format: " << fmt << ". Supported formats are AVI and MP4." << endl;
 		return 1;
     }
 
 
+    CorruptionJournal journal;
+    ostream null_log(nullptr);
+    if (quiet) corruptor->setLog(&null_log);
+    corruptor->setMemoryMapped(use_mmap);
+    corruptor->setAnalysisCache(use_cache);
+    corruptor->setThreads(threads);
+    if (has_seed) {
+        corruptor->setSeed(seed);
+    }
+    if (target) {
+        if (!dynamic_cast<MP4Corruptor*>(corruptor)) {
+            cerr << "--target needs the NAL index of an MP4 input." << endl;
+            delete corruptor;
+            return 1;
+        }
+        corruptor->setTarget(target);
+    }
+    if (!journal_file.empty()) {
+        corruptor->setJournal(&journal);
+    }
     if (!corruptor->loadFile(input_file)) {
         return 1;
     }
     corruptor->printFileInfo();
-    corruptor->applyCorruption();
 
-    if (corruptor->saveFile(output_file)) {
+    if (variants > 0) {
+        // one load and analysis, n outputs
+        uint64_t base_seed = corruptor->getSeed();
+        vector<VideoCorruptor::Variant> list;
+        for (size_t i = 0; i < variants; i++) {
+            list.push_back({ base_seed + i, {}, journal_only ? "" : variantName(output_file, i + 1),
+                journal_file.empty() ? "" : variantName(journal_file, i + 1),
+                metrics_file.empty() || metrics_file == "-" ? metrics_file : variantName(metrics_file, i + 1) });
+        }
+        size_t written = corruptor->generateVariants(list);
         delete corruptor;
-        cout << "Corrupted video saved to: " << output_file << endl;
+        if (!quiet) cout << written << "/" << variants << " variants written" << endl;
+        return written == variants ? 0 : 1;
     }
-    else {
-        delete corruptor;
-        cerr << "Save failed." << endl;
-        return 1;
+
+    // the output is written behind the corruption sweep, saveFile below completes it
+    if (!journal_only) corruptor->beginSave(output_file);
+    corruptor->applyCorruption();
+
+    if (!journal_file.empty()) {
+        if (!journal.save(journal_file)) {
+            delete corruptor;
+            return 1;
+        }
+        if (!quiet) cout << "Journal with " << journal.size() << " entries (" << journal.mutatedBytes()
+            << " bytes) saved to: " << journal_file << endl;
     }
-    
-    
-    return 0;
+    if (!journal_only) {
+        if (!corruptor->saveFile(output_file)) {
+            delete corruptor;
+            cerr << "Save failed." << endl;
+            return 1;
+        }
+        if (!quiet) cout << "Corrupted video saved to: " << output_file << endl;
+    }
+    bool ok = metrics_file.empty() || corruptor->getMetrics().save(metrics_file);
+    delete corruptor;
+    return ok ? 0 : 1;
 }
\ No newline at end of file